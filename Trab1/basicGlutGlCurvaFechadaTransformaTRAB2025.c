@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <math.h>
 #include "GL/glut.h"
+#include "../comum/spline.h"
 
 #define MAXVERTEXS 30 
 #define NPOLYGON 6 
@@ -38,40 +39,7 @@ int ptoSelect = -1;
 int tipoCurva = 0;
 int tipoTransforma = 0;
 
-	// matriz de trabalho
-float M[4][4] = 
-	{{0.0, 0.0, 0.0, 0.0},
-	 {0.0, 0.0, 0.0, 0.0},
-	 {0.0, 0.0, 0.0, 0.0},
-	 {0.0, 0.0, 0.0, 0.0}};
-
-	// matriz de Hermite
-float Mh[4][4] = 
-	{{1.0, 0.0, 0.0, 0.0},
-	 {0.0, 1.0, 0.0, 0.0},
-	 {0.0, 0.0, 1.0, 0.0},
-	 {0.0, 0.0, 0.0, 1.0}};
-
-	// matriz de Bezier
-float Mb[4][4] = 
-	{{1.0, 0.0, 0.0, 0.0},
-	 {0.0, 1.0, 0.0, 0.0},
-	 {0.0, 0.0, 1.0, 0.0},
-	 {0.0, 0.0, 0.0, 1.0}};
-
-	// matriz de B-spline  * 6
-float Ms[4][4] = 
-	{{1.0, 0.0, 0.0, 0.0},
-	 {0.0, 1.0, 0.0, 0.0},
-	 {0.0, 0.0, 1.0, 0.0},
-	 {0.0, 0.0, 0.0, 1.0}};
-
-	// matriz de Catmull Rom  * 2
-float Mc[4][4] = 
-	{{-1.0, 3.0, -3.0, 1.0},
-	 {2.0, -5.0, 4.0, -1.0},
-	 {-1.0, 0.0, 1.0, 0.0},
-	 {0.0, 2.0, 0.0, 0.0}};
+	// matrizes de base: splineMatriz em spline.h
 
 float MCor[9][3] =
 	{
@@ -91,7 +59,7 @@ int nCors = 9;
 void ptoCurva(float t, int j, float pp[3])
 {
     int i, ji;
-	float cc;
+	float g[4][3];
     tipoPto ptsCont[MAXVERTEXS];
 
 	pp[0]=pp[1]=pp[2]=0.0;
@@ -121,10 +89,18 @@ void ptoCurva(float t, int j, float pp[3])
 
 	for(i=0; i<4; i++)
 	{
-		cc = t*t*t*M[0][i] + t*t*M[1][i] + t*M[2][i] + M[3][i];
-		pp[0] += cc * ptsCont[i].v[0];
-		pp[1] += cc * ptsCont[i].v[1];
-		pp[2] += cc * ptsCont[i].v[2];
+		g[i][0] = ptsCont[i].v[0];
+		g[i][1] = ptsCont[i].v[1];
+		g[i][2] = ptsCont[i].v[2];
+	}
+
+		// uma chamada por base: cada uma e compilada com a sua matriz
+	switch(tipoCurva)
+	{
+		case HERMITE:  splinePonto(SPLINE_HERMITE, t, g, pp); break;
+		case BEZIER:   splinePonto(SPLINE_BEZIER, t, g, pp); break;
+		case BSPLINE:  splinePonto(SPLINE_BSPLINE, t, g, pp); break;
+		case CATMULLR: splinePonto(SPLINE_CATMULLROM, t, g, pp); break;
 	}
 }
 
@@ -269,40 +245,16 @@ static void Args(int argc, char **argv)
 
 void processMenuCurvas(int option) 
 {
-	int i, j;
-
-	tipoCurva = option;
+	tipoCurva = option;		// ptoCurva usa a base de spline.h conforme tipoCurva
 	if (nPtsCtrole>3) {
 		switch (option) 
 		{
 			case HERMITE: 
-				jaCurva = 1;
-				for(i=0; i<4; i++)           // M := Mh  <--  como matiz de HERMITE
-					for(j=0; j<4; j++)
-						M[i][j] = Mh[i][j];
-				break;
-
 			case BEZIER:
-				jaCurva=1;
-				for(i=0; i<4; i++)           // M := Mb  <-- copia matriz de BEZIER
-					for(j=0; j<4; j++)
-						M[i][j] = Mb[i][j];
-				break;
-
 			case BSPLINE:
-				jaCurva=1;
-				for(i=0; i<4; i++)           // M := Ms  <-- copia matriz de BSPLINE
-					for(j=0; j<4; j++)
-						M[i][j] = Ms[i][j] / 6;
-				break;
-
 			case CATMULLR: 
 				jaCurva = 1;
-				for(i=0; i<4; i++)            // M := Mc  <-- copia matriz de CatMULLR
-					for(j=0; j<4; j++)
-						M[i][j] = Mc[i][j] / 2;
 				break;
-		break;
 		}	
 	}
 	glutPostRedisplay(); 
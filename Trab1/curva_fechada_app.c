@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include "../comum/spline.h"
 
 #define MAXVERTEXS 30
 #define MAXCURPOINTS 80
@@ -47,17 +48,7 @@ int tipoTransforma = 0;
 int windW = 300, windH = 250;
 int doubleBuffer = 0;
 
-/* matrizes de base (inicializadas a partir do seu código) */
-float Mh[4][4] = { {1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1} };
-float Mb[4][4] = { {1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1} };
-float Ms[4][4] = { {1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1} };
-float Mc[4][4] = { {-1.0, 3.0, -3.0, 1.0},
-                   { 2.0, -5.0,  4.0, -1.0},
-                   {-1.0, 0.0,  1.0, 0.0},
-                   { 0.0, 2.0,  0.0, 0.0} };
-
-/* matriz de trabalho M (coeficientes usados em ptoCurva) */
-float M[4][4];
+/* matrizes de base: splineMatriz (spline.h), escolhida por tipoCurva */
 
 /* cores para pedaços */
 float MCor[9][3] = {
@@ -200,12 +191,12 @@ void geraMatrizCisalha(float shx, float shy, float cx, float cy) {
     }
 }
 
-/* --- ptoCurva: calcula ponto da curva para dado t e segmento j (usando M) ---
+/* --- ptoCurva: calcula ponto da curva para dado t e segmento j (base de tipoCurva) ---
    função inspirada no seu arquivo base (fechamento por wrap) */
 void ptoCurva(float t, int j, float pp[3]) {
     int i, ji;
     tipoPto ptsCont[4];
-    float cc;
+    float g[4][3];
     pp[0]=pp[1]=pp[2]=0.0f;
     if(nPtsControl < 4) return;
 
@@ -232,11 +223,18 @@ void ptoCurva(float t, int j, float pp[3]) {
         for(i=0;i<4;i++) ptsCont[i]=tmp[i];
     }
 
-    for(i=0;i<4;i++){
-        cc = t*t*t*M[0][i] + t*t*M[1][i] + t*M[2][i] + M[3][i];
-        pp[0] += cc * ptsCont[i].v[0];
-        pp[1] += cc * ptsCont[i].v[1];
-        pp[2] += cc * ptsCont[i].v[2];
+    for(i=0;i<4;i++) {
+        g[i][0] = ptsCont[i].v[0];
+        g[i][1] = ptsCont[i].v[1];
+        g[i][2] = ptsCont[i].v[2];
+    }
+
+    /* uma chamada por base: cada uma é compilada com a sua matriz */
+    switch(tipoCurva) {
+        case HERMITE:  splinePonto(SPLINE_HERMITE, t, g, pp); break;
+        case BEZIER:   splinePonto(SPLINE_BEZIER, t, g, pp); break;
+        case BSPLINE:  splinePonto(SPLINE_BSPLINE, t, g, pp); break;
+        case CATMULLR: splinePonto(SPLINE_CATMULLROM, t, g, pp); break;
     }
 }
 
@@ -282,27 +280,10 @@ static void Draw(void) {
     if(doubleBuffer) glutSwapBuffers(); else glFlush();
 }
 
-/* tratamento do menu de curvas: copia M conforme tipo */
+/* tratamento do menu de curvas: ptoCurva usa a base de tipoCurva */
 void processMenuCurvas(int option) {
-    int i,j;
     tipoCurva = option;
-    if(nPtsControl>=4) {
-        switch(option) {
-            case HERMITE:
-                for(i=0;i<4;i++) for(j=0;j<4;j++) M[i][j] = Mh[i][j];
-                break;
-            case BEZIER:
-                for(i=0;i<4;i++) for(j=0;j<4;j++) M[i][j] = Mb[i][j];
-                break;
-            case BSPLINE:
-                for(i=0;i<4;i++) for(j=0;j<4;j++) M[i][j] = Ms[i][j]/6.0f;
-                break;
-            case CATMULLR:
-                for(i=0;i<4;i++) for(j=0;j<4;j++) M[i][j] = Mc[i][j]/2.0f;
-                break;
-        }
-        geraCurva();
-    }
+    if(nPtsControl>=4) geraCurva();
     glutPostRedisplay();
 }
 
@@ -359,8 +340,8 @@ void processMenuEvents(int option) {
         case 3: /* finalizar polígono (ativa geração de curva) */
             if(nPtsControl >= 4) {
                 jaCurva = 1;
-                /* deixa a matriz M com Bezier por default */
-                for(int i=0;i<4;i++) for(int j=0;j<4;j++) M[i][j] = Mb[i][j];
+                /* Bezier por default */
+                tipoCurva = BEZIER;
                 geraCurva();
             }
             break;
@@ -474,12 +455,6 @@ void init(void) {
     jaCurva = 0;
     ptoSelect = -1;
     tipoCurva = BEZIER;
-    /* inicializar Mb como matriz base Bezier (padrão topológica simples) */
-    Mb[0][0]=1; Mb[0][1]=0; Mb[0][2]=0; Mb[0][3]=0;
-    Mb[1][0]=0; Mb[1][1]=1; Mb[1][2]=0; Mb[1][3]=0;
-    Mb[2][0]=0; Mb[2][1]=0; Mb[2][2]=1; Mb[2][3]=0;
-    Mb[3][0]=0; Mb[3][1]=0; Mb[3][2]=0; Mb[3][3]=1;
-    /* (as matrizes exatas e a formulação foram usadas do seu código original). */
 }
 
 int main(int argc, char** argv) {
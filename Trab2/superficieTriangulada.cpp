@@ -1,9 +1,38 @@
 // superficieTriangulada.cpp
 // Versão triangulada com 2 fontes de luz e sombreamento por triângulo
+#ifndef _WIN32
+#define GL_GLEXT_PROTOTYPES   // glGenBuffers e cia (OpenGL 1.5) direto da libGL
+#define USA_VBO 1
+#endif
 #include <GL/glut.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <string.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <chrono>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USA_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#include "../comum/spline.h"
+#include "../comum/imagem.h"
 
 #define Linha -1
 #define Solido -2
@@ -13,6 +42,7 @@
 #define GirarX 13
 #define GirarY 14
 #define GirarZ 15
+#define EditarPonto 16
 
 #define BEZIER 20
 #define BSPLINE 21
@@ -24,6 +54,22 @@
 #define OBJ_CUBO     31
 #define OBJ_ESFERA   32
 
+#define AVAL_MATRIZ     50
+#define AVAL_DIFERENCAS 51
+
+#define TESS_UNIFORME   60
+#define TESS_ADAPTATIVA 61
+#define TESS_TELA       62
+
+#define THREADS_1      40
+#define THREADS_2      41
+#define THREADS_4      42
+#define THREADS_8      43
+#define THREADS_TODAS  44
+
+#define PERFIL_OVERLAY 70
+#define SALVAR_IMAGEM  71
+
 #define sair 0
 
 #define X 0
@@ -32,14 +78,24 @@
 
 typedef float f4d[4];
 
+// grade n x m de pontos. Os pontos ficam em um unico bloco contiguo
+// (linha a linha) e ponto[i] aponta para o inicio da linha i dentro dele.
+// Cada linha pode ter depois dela colunas fantasmas, copias das primeiras
+// colunas, para que os patches que dao a volta em j sejam lidos direto da
+// grade (linhas com m + fantasmas pontos).
 typedef struct st_matriz
 {
     int n, m;
+    int fantasmas;     // colunas repetidas no fim de cada linha
     f4d **ponto;
+    size_t tamBloco;   // bytes reservados em bloco
+    void *bloco;
 } matriz;
 
 int comando = GirarX;
 
+int pontoSel[2] = {0, 0};   // ponto de pc (linha, coluna) editado pelas setas
+
 int tipoView = GL_LINE_STRIP;
 
 float local_scale = 0.22f;
@@ -49,6 +105,13 @@ float VARIA = 0.04f;
 
 f4d AuxVertex[3];
 
+// transformacao acumulada pelas setas, na mesma convencao de AuxVertex
+// (p_mundo = p * matModelo). Os pontos de controle nao sao alterados: a
+// matriz e aplicada no desenho (AplicaModelo) e as luzes sao levadas para
+// o espaco do objeto na iluminacao.
+f4d matModelo[3] = {{1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}};
+int versaoModelo = 0;         // incrementada a cada alteracao de matModelo
+
 f4d MatBase[4];   // matriz de base
 
 f4d pview = {10.0, 10.0, -20.0, 0.0};
@@ -60,81 +123,345 @@ f4d vcolor[4] = {{1.0, 0.2, 0.2, 0.0},
 
 
 matriz *pc = NULL;  //matriz de pontos de controle
-matriz *pcPatch = NULL;  // matriz de pontos para um patch
-matriz *pMatriz = NULL;
+int numThreads = 1;   // threads usadas para tesselar (0 = todos os nucleos)
+
+int tipoSuperficie = BEZIER;  // base usada em MatBase
+int versaoPc = 0;             // incrementada a cada alteracao de pc
+int ctrlEditIni = -1, ctrlEditFim = 0;   // pontos de pc editados desde o ultimo envio
+
+// malha de triangulos do objeto inteiro: um vetor de vertices e indices de
+// 32 bits. Na malha soldada os vertices das costuras entre patches sao
+// compartilhados (e avaliados uma vez so).
+typedef struct st_malha
+{
+    int nVert, nTri, nLin;
+    f4d *vert;
+    f4d *normal;             // normal unitaria de cada vertice (analitica)
+    unsigned int *tri;       // 3 indices por triangulo
+    unsigned char *corTri;   // indice em vcolor do patch de cada triangulo
+    unsigned int *lin;       // 2 indices por aresta (modo malha)
+    int mapeada;             // vetores dentro de um .stb mapeado (so leitura)
+    // bytes reservados no heap para cada vetor (Cresce); 0 se mapeados
+    size_t tamVert, tamNormal, tamTri, tamCorTri, tamLin;
+} malha;
+
+// cache da tesselacao, valido enquanto (tipoSuperficie, VARIA, versaoPc,
+// modos) nao mudarem. O patch (i, j) tem segS[i] x segT[j] segmentos.
+// Soldada: a malha e uma grade global com colunasV colunas (fechada em t)
+// e o patch (i, j) comeca na linha offS[i] e coluna offT[j]. Nao soldada
+// (Bezier, cujos patches vizinhos nao se tocam): cada patch tem o seu
+// bloco de vertices a partir de basePatch[i*m + j].
+typedef struct st_cacheSuperficie
+{
+    int nPatches;
+    int tipoBase;
+    float varia;
+    int versao;
+    int modo;
+    int tess;
+    float tol;
+    float pxSeg;                 // LOD de tela: pixelsSegmento usado
+    int vistaModelo;             // e a vista (versaoModelo, pixelsPorUnidade)
+    float vistaEscala;           // em que os segmentos foram escolhidos
+    int nLinhasPatch, nColunasPatch;
+    int *segS;
+    int *segT;
+    int soldada;
+    int *offS, *offT, *basePatch;
+    int colunasV;
+    int geracao;      // incrementada a cada reavaliacao dos vertices
+    std::atomic<int> degeneradas;   // vertices com normal indefinida
+    std::atomic<int> semMemoria;    // algum patch nao pode ser avaliado
+    int *baseTri;     // primeiro triangulo de cada patch
+    unsigned char *degVert;   // vertices cuja normal e media dos vizinhos
+    // edicao de pontos (EditaPontoControle): patches a reavaliar e, depois
+    // da reavaliacao, os conjuntos que o envio ao OpenGL precisa refazer
+    unsigned char *sujo, *marca;
+    int *listaSujos, nSujos;
+    int *listaB, nB;   // sujos e vizinhos a 1 patch: normais e iluminacao
+    int *listaC, nC;   // sujos e vizinhos de -2 a +1: triangulos
+    int parcial;       // listas validas ainda nao enviadas
+    // pontos de Bezier de cada patch (16 por patch, linha a linha),
+    // convertidos de pc uma vez por versao da rede e base. Na base de
+    // Bezier os patches sao vistas de pc e bezier nao e usado.
+    f4d *bezier;
+    int nBezier, versaoBezier, baseBezier;
+    // bytes reservados para os vetores acima, que so crescem (Cresce)
+    size_t tamBezier, tamSegS, tamSegT, tamOffS, tamOffT, tamBasePatch, tamBaseTri, tamDegVert;
+    size_t tamSujo, tamMarca, tamListaSujos, tamListaB, tamListaC;
+    malha sup;
+} cacheSuperficie;
+
+cacheSuperficie cacheSup;
+
+static void GravaCachePendente(cacheSuperficie *c);
+int EditaPontoControle(int i, int j, const f4d p);
+
+int modoAvaliacao = AVAL_MATRIZ;   // forma matricial ou diferencas progressivas
+
+int modoTesselacao = TESS_UNIFORME;
+float tolCorda = 0.01f;   // erro de corda maximo da tesselacao adaptativa
+float pixelsSegmento = 8.0f;    // LOD de tela: tamanho de um segmento na janela
+float pixelsPorUnidade = 35.0f; // pixels por unidade do glOrtho de reshape()
+
+// pesos de Bezier para cada amostra: peso[k] = [s^3 s^2 s 1] MBezier, com
+// s percorrendo 0, VARIA, 2*VARIA, ... Todos os patches sao convertidos
+// para a forma de Bezier (ConvertePatches), entao as tabelas nao dependem
+// da base. Os mesmos valores servem para S G e para G^t T, e sao
+// compartilhados por todos os patches e quadros.
+// plano[h][k] repete peso[k][h] em 4 vetores alinhados (com zeros ate
+// um multiplo de 8) para os kernels SIMD.
+// Com nSeg > 0 a tabela tem nSeg+1 amostras exatas k/nSeg (tesselacao
+// adaptativa) em vez de acumular VARIA. deriv aponta para a tabela com as
+// derivadas dos pesos ([3s^2 2s 1 0] MBezier) nas mesmas amostras.
+typedef struct st_tabelaPesos
+{
+    float varia;
+    int nSeg;
+    int n;
+    f4d *peso;
+    float *plano[4];
+    void *blocoPlanos;
+    struct st_tabelaPesos *deriv;
+    int cap;       // amostras reservadas por plano (so cresce)
+} tabelaPesos;
+
+tabelaPesos tabPesos = {};
+
+// tabelas da tesselacao adaptativa, indexadas pelo numero de segmentos
+tabelaPesos *tabSeg = NULL;
+int nTabSeg = 0;
+
+// avalia uma linha da grade: linha[j] = va * peso[j], j = 0..m-1
+typedef void (*kernelLinha)(f4d va[4], const tabelaPesos *tab, int m, f4d *linha);
+
+#define KERNEL_ESCALAR 0
+#define KERNEL_SSE     1
+#define KERNEL_AVX2    2
+
+kernelLinha kernelLinhaSup = NULL;
+int nivelKernel = KERNEL_ESCALAR;
 
-// duas fontes de luz (world coordinates)
-f4d lightPos1 = {30.0f, 30.0f, 30.0f, 1.0f}; // luz principal
-f4d lightPos2 = {-20.0f, 10.0f, -10.0f, 1.0f}; // luz secundária
+// fontes de luz pontuais (world coordinates). peso escala a contribuicao
+// difusa da luz; cor so e usada no indicador desenhado na cena
+#define MAX_LUZES 8
+
+typedef struct st_fonteLuz
+{
+    f4d pos;
+    float peso;
+    float cor[3];
+} fonteLuz;
+
+fonteLuz luzes[MAX_LUZES] = {
+    {{30.0f, 30.0f, 30.0f, 1.0f}, 1.0f, {1.0f, 0.9f, 0.7f}},    // luz principal
+    {{-20.0f, 10.0f, -10.0f, 1.0f}, 0.6f, {0.7f, 0.8f, 1.0f}},  // luz secundária
+};
+int nLuzes = 2;
+float luzAmbiente = 0.25f;
+
+// coeficiente de atenuacao das luzes, em unidades do mundo
+#define ATENUACAO 0.005f
+
+// ilumina n vertices com nf fontes: luz[v] = min(ambiente + sum peso * difusa, 1)
+typedef void (*kernelLuz)(const f4d *pos, const f4d *normal, int n,
+                          const fonteLuz *fontes, int nf, float katt, float *luz);
+kernelLuz kernelIluminacao = NULL;
 
 void DisenaSuperficie(void);
 
+// base de spline.h de cada tipo de superficie
+static int BaseSpline(int tipoSup)
+{
+    if(tipoSup == BSPLINE) return SPLINE_BSPLINE;
+    if(tipoSup == CATMULLROM) return SPLINE_CATMULLROM;
+    return SPLINE_BEZIER;
+}
+
 void MontaMatrizBase(int tipoSup)
 {
-    if(tipoSup==BEZIER)
-    {
-        MatBase[0][0] = -1.0; MatBase[0][1] = 3.0;  MatBase[0][2] = -3.0; MatBase[0][3] = 1.0;
-        MatBase[1][0] =  3.0; MatBase[1][1] = -6.0; MatBase[1][2] =  3.0; MatBase[1][3] = 0.0;
-        MatBase[2][0] = -3.0; MatBase[2][1] = 3.0;  MatBase[2][2] =  0.0; MatBase[2][3] = 0.0;
-        MatBase[3][0] =  1.0; MatBase[3][1] = 0.0;  MatBase[3][2] =  0.0; MatBase[3][3] = 0.0;
-    }
+    tipoSuperficie = tipoSup;
+    memcpy(MatBase, splineMatriz[BaseSpline(tipoSup)], sizeof(MatBase));
+}
 
-    if(tipoSup==BSPLINE)
+matriz* liberaMatriz(matriz* sup)
+{
+    if(sup)
     {
-        MatBase[0][0] = -1.0/6.0; MatBase[0][1] = 3.0/6.0;  MatBase[0][2] = -3.0/6.0; MatBase[0][3] = 1.0/6.0;
-        MatBase[1][0] =  3.0/6.0; MatBase[1][1] = -6.0/6.0; MatBase[1][2] =  3.0/6.0; MatBase[1][3] = 0.0/6.0;
-        MatBase[2][0] = -3.0/6.0; MatBase[2][1] = 0.0/6.0;  MatBase[2][2] =  3.0/6.0; MatBase[2][3] = 0.0/6.0;
-        MatBase[3][0] =  1.0/6.0; MatBase[3][1] = 4.0/6.0;  MatBase[3][2] =  1.0/6.0; MatBase[3][3] = 0.0/6.0;
+        free(sup->bloco);
+        free(sup);
     }
+    return NULL;
+}
 
-    if(tipoSup==CATMULLROM)
-    {
-        MatBase[0][0] = -1.0/2.0; MatBase[0][1] = 3.0/2.0;  MatBase[0][2] = -3.0/2.0; MatBase[0][3] = 1.0/2.0;
-        MatBase[1][0] =  2.0/2.0; MatBase[1][1] = -5.0/2.0; MatBase[1][2] =  4.0/2.0; MatBase[1][3] = -1.0/2.0;
-        MatBase[2][0] = -1.0/2.0; MatBase[2][1] = 0.0/2.0;  MatBase[2][2] =  1.0/2.0; MatBase[2][3] = 0.0/2.0;
-        MatBase[3][0] =  0.0/2.0; MatBase[3][1] = 2.0/2.0;  MatBase[3][2] =  0.0/2.0; MatBase[3][3] = 0.0/2.0;
-    }
+#define ALINHA(x) (((x) + 31) & ~(size_t)31)
 
+// bytes necessarios no bloco para uma grade n x m
+static size_t tamanhoBloco(int n, int m, int fantasmas)
+{
+    size_t tam;
+
+    tam = ALINHA(n * sizeof(f4d*)) + ALINHA((size_t)n * (m + fantasmas) * sizeof(f4d));
+    return tam + 31;   // folga para alinhar o inicio do bloco
 }
 
-matriz* liberaMatriz(matriz* sup)
+// muda as dimensoes da grade reaproveitando o bloco sempre que ele tiver
+// espaco suficiente. O conteudo anterior nao e preservado (fica zerado).
+int RedimensionaMatriz(matriz *sup, int n, int m)
 {
+    size_t tam, tamPontos;
+    char *p;
+    f4d *dados;
     int i;
 
-    if(sup)
+    tam = tamanhoBloco(n, m, sup->fantasmas);
+    if(tam > sup->tamBloco)
     {
-        for(i=0; i< sup->n; i++)
+        free(sup->bloco);
+        if((sup->bloco = malloc(tam))==NULL)
         {
-            free(sup->ponto[i]);
+            printf("\n Error en alocacion de memoria para uma matriz");
+            sup->tamBloco = 0;
+            sup->n = sup->m = 0;
+            return 0;
         }
-        free(sup->ponto);
-        free(sup);
+        sup->tamBloco = tam;
     }
-    return NULL;
-}
 
+    sup->n = n;
+    sup->m = m;
+
+    p = (char*) ALINHA((size_t) sup->bloco);
+    sup->ponto = (f4d**) p;
+    p += ALINHA(n * sizeof(f4d*));
 
-matriz* AlocaMatriz(int n, int m)
+    tamPontos = (size_t)n * (m + sup->fantasmas) * sizeof(f4d);
+    dados = (f4d*) p;
+    memset(dados, 0, tamPontos);
+    for(i=0; i<n; i++)
+        sup->ponto[i] = dados + (size_t)i * (m + sup->fantasmas);
+    return 1;
+}
+
+static matriz* novaMatriz(int n, int m, int fantasmas)
 {
     matriz *matTemp;
-    int j;
 
-    if((matTemp = (matriz*) malloc(sizeof(matriz)))==NULL)
+    if((matTemp = (matriz*) calloc(1, sizeof(matriz)))==NULL)
     {
         printf("\n Error en alocacion de memoria para uma matriz");
         return 0;
     }
 
-    matTemp->n = n;
-    matTemp->m = m;
-    matTemp->ponto = (f4d**) calloc(n, sizeof(f4d*));
-
-    for(j=0; j<matTemp->n; j++)
-         matTemp->ponto[j] = (f4d*) calloc(m, sizeof(f4d));
+    matTemp->fantasmas = fantasmas;
+    if(!RedimensionaMatriz(matTemp, n, m))
+    {
+        free(matTemp);
+        return 0;
+    }
 
     return matTemp;
 }
 
+// rede de pontos de controle: as colunas se fecham em j, entao cada linha
+// leva as 3 colunas que um patch bicubico le depois da ultima
+#define FANTASMAS 3
+
+matriz* AlocaRede(int n, int m)
+{
+    return novaMatriz(n, m, FANTASMAS);
+}
+
+// recopia as colunas fantasmas das linhas i0..i1-1 (m < 3 da mais de uma volta)
+void AtualizaFantasmas(matriz *sup, int i0, int i1)
+{
+    int i, c;
+
+    for(i = i0; i < i1; i++)
+        for(c = 0; c < sup->fantasmas; c++)
+            memcpy(sup->ponto[i][sup->m + c], sup->ponto[i][c % sup->m], sizeof(f4d));
+}
+
+// ---- memoria do desenho ----
+// chamadasHeap conta as chamadas a malloc/realloc/free do desenho e da
+// tesselacao; o perfil mostra as de cada quadro. Os vetores que dependem
+// do tamanho da malha so crescem (Cresce), e o rascunho que so vive
+// durante um quadro vem de arenaQuadro. Depois dos primeiros quadros com
+// a maior malha, um quadro nao chama o heap.
+std::atomic<long long> chamadasHeap(0);
+
+// bloco *p com pelo menos tam bytes (capacidade em *cap). So cresce e
+// preserva o conteudo; se faltar memoria devolve 0 e *p e *cap ficam
+// como estavam.
+template<class T> static int Cresce(T **p, size_t *cap, size_t tam)
+{
+    T *novo;
+
+    if(*p && tam <= *cap) return 1;
+    chamadasHeap++;
+    if((novo = (T*) realloc(*p, tam)) == NULL)
+    {
+        printf("\n Error en alocacion de memoria (%lu bytes)", (unsigned long) tam);
+        return 0;
+    }
+    *p = novo;
+    *cap = tam;
+    return 1;
+}
+
+// alocacao por incremento num bloco so, usada so pela thread principal.
+// O que nao cabe vai para blocos extras; quando a arena esvazia, eles sao
+// liberados e o bloco cresce para o maior uso visto.
+typedef struct st_arena
+{
+    char *bloco;
+    size_t tam, usado, pico;
+    void *extra;   // lista dos blocos extras (o ponteiro fica no inicio)
+} arena;
+
+arena arenaQuadro = {NULL, 0, 0, 0, NULL};
+
+void* ArenaAloca(arena *a, size_t tam)
+{
+    char *p;
+
+    tam = ALINHA(tam);
+    a->usado += tam;
+    if(a->usado > a->pico) a->pico = a->usado;
+    if(a->usado <= a->tam) return a->bloco + (a->usado - tam);
+
+    chamadasHeap++;
+    if((p = (char*) malloc(tam + 32)) == NULL)
+    {
+        printf("\n Error en alocacion de memoria para o rascunho do quadro");
+        return NULL;
+    }
+    *(void**) p = a->extra;
+    a->extra = p;
+    return p + 32;
+}
+
+// devolve tudo o que foi alocado depois de marca (um a->usado anterior).
+// Em O(1), a menos que a arena esvazie depois de ter transbordado.
+void ArenaLibera(arena *a, size_t marca)
+{
+    void *p;
+
+    a->usado = marca;
+    if(marca || !a->extra) return;
+
+    while((p = a->extra) != NULL)
+    {
+        a->extra = *(void**) p;
+        free(p);
+        chamadasHeap++;
+    }
+    free(a->bloco);
+    a->bloco = (char*) malloc(a->pico);
+    a->tam = a->bloco ? a->pico : 0;
+    chamadasHeap += 2;
+}
+
 
 void MatrizIdentidade()
 {
@@ -151,56 +478,51 @@ void MatrizIdentidade()
     }
 }
 
+// acumula AuxVertex na transformacao do objeto: O(1), sem tocar em pc
 void MultMatriz()
 {
-    int j,k;
-    f4d auxiliar;
-    for(j=0; j< pc->n; j++)
-    {
-        for(k = 0; k< pc->m; k++)
-        {
-         auxiliar[X] = pc->ponto[j][k][X];
-         auxiliar[Y] = pc->ponto[j][k][Y];
-         auxiliar[Z] = pc->ponto[j][k][Z];
+    int a, b;
+    f4d aux[3];
 
-         pc->ponto[j][k][X] = auxiliar[X] * AuxVertex[0][X] +
-                              auxiliar[Y] * AuxVertex[1][X] +
-                              auxiliar[Z] * AuxVertex[2][X];
+    for(a=0; a<3; a++)
+        for(b=0; b<3; b++)
+            aux[a][b] = matModelo[a][X] * AuxVertex[X][b] +
+                        matModelo[a][Y] * AuxVertex[Y][b] +
+                        matModelo[a][Z] * AuxVertex[Z][b];
 
-         pc->ponto[j][k][Y] = auxiliar[X] * AuxVertex[0][Y] +
-                              auxiliar[Y] * AuxVertex[1][Y] +
-                              auxiliar[Z] * AuxVertex[2][Y];
+    for(a=0; a<3; a++)
+        for(b=0; b<3; b++)
+            matModelo[a][b] = aux[a][b];
 
-         pc->ponto[j][k][Z] = auxiliar[X] * AuxVertex[0][Z] +
-                              auxiliar[Y] * AuxVertex[1][Z] +
-                              auxiliar[Z] * AuxVertex[2][Z];
-        }
-    }
+    versaoModelo++;
+}
 
-    for(j=0; j< pMatriz->n; j++)
-    {
-      for(k = 0; k< pMatriz->m; k++)
-      {
-         auxiliar[X] = pMatriz->ponto[j][k][X];
-         auxiliar[Y] = pMatriz->ponto[j][k][Y];
-         auxiliar[Z] = pMatriz->ponto[j][k][Z];
+void ModeloIdentidade()
+{
+    int a, b;
+
+    for(a=0; a<3; a++)
+        for(b=0; b<4; b++)
+            matModelo[a][b] = a == b ? 1.0f : 0.0f;
 
-         pMatriz->ponto[j][k][X] = auxiliar[X] * AuxVertex[0][X] +
-                                   auxiliar[Y] * AuxVertex[1][X] +
-                                   auxiliar[Z] * AuxVertex[2][X];
+    versaoModelo++;
+}
 
-         pMatriz->ponto[j][k][Y] = auxiliar[X] * AuxVertex[0][Y] +
-                                   auxiliar[Y] * AuxVertex[1][Y] +
-                                   auxiliar[Z] * AuxVertex[2][Y];
+// multiplica a matriz corrente do OpenGL pela transformacao do objeto
+void AplicaModelo(void)
+{
+    GLfloat m[16];
+    int a, b;
 
-         pMatriz->ponto[j][k][Z] = auxiliar[X] * AuxVertex[0][Z] +
-                                   auxiliar[Y] * AuxVertex[1][Z] +
-                                   auxiliar[Z] * AuxVertex[2][Z];
-      }
-    }
+    // coluna de OpenGL = linha de matModelo (vetor linha x vetor coluna)
+    for(a=0; a<4; a++)
+        for(b=0; b<4; b++)
+            m[a*4 + b] = (a < 3 && b < 3) ? matModelo[a][b] : (a == b ? 1.0f : 0.0f);
+
+    glMultMatrixf(m);
 }
 
-void prod_VetParam_MatBase(float x, float *xx, float *vr)
+void prod_VetParam_Bezier(float x, float *xx, float *vr)
 {
     int i, j;
 
@@ -213,7 +535,7 @@ void prod_VetParam_MatBase(float x, float *xx, float *vr)
     {
         vr[i] = 0.0f;
         for(j=0; j<4; j++)
-            vr[i] += MatBase[j][i] * xx[j];
+            vr[i] += splineMatriz[SPLINE_BEZIER][j][i] * xx[j];
     }
 }
 
@@ -233,499 +555,4352 @@ void prod_VetMatriz(float *v, f4d **pc, f4d *vr)
     }
 }
 
-void ptsSuperficie(void)
+// derivada de [s^3 s^2 s 1] MBezier em relacao a s
+void prod_VetParamDeriv_Bezier(float x, float *xx, float *vr)
 {
-    int i, j, h, n, m;
-    float t,s;
-    float tmp[4], vsm[4], vtm[4];
-    f4d va[4];
-
-    if(!pc) return;
+    int i, j;
 
-    n = 0;
+    xx[0] = 3.0f * x * x;
+    xx[1] = 2.0f * x;
+    xx[2] = 1.0f;
+    xx[3] = 0.0f;
 
-    for(s = 0; s<=1.01; s+=VARIA) n += 1;
+    for(i=0; i<4; i++)
+    {
+        vr[i] = 0.0f;
+        for(j=0; j<4; j++)
+            vr[i] += splineMatriz[SPLINE_BEZIER][j][i] * xx[j];
+    }
+}
 
-    m = n;
+// tabela sem vetores, como antes da primeira montagem
+static void esvaziaTabela(tabelaPesos *tab)
+{
+    free(tab->peso);
+    free(tab->blocoPlanos);
+    tab->peso = NULL;
+    tab->blocoPlanos = NULL;
+    tab->cap = tab->n = 0;
+}
 
-    if (pMatriz) pMatriz = liberaMatriz(pMatriz);
+// (re)monta a tabela: nSeg = 0 amostra s = 0, VARIA,
+// 2*VARIA, ... como antes; nSeg > 0 amostra s = k/nSeg, k = 0..nSeg.
+// A tabela de derivadas (tab->deriv) e montada junto.
+// Sem memoria a tabela fica vazia (peso NULL, cap 0) e devolve 0.
+static int preencheTabelaPesos(tabelaPesos *tab, int nSeg, int derivada)
+{
+    int k, h, n, nPad;
+    float s, passo;
+    float tmp[4];
 
-    pMatriz=AlocaMatriz(n,m);
+    if(nSeg > 0)
+    {
+        n = nSeg + 1;
+        passo = 1.0f / nSeg;
+    }
+    else
+    {
+        n = 0;
+        for(s = 0; s<=1.01; s+=VARIA) n += 1;
+        passo = VARIA;
+    }
 
-    s=0.0f;
-    for(i = 0; i < pMatriz->n; i++)
+    // os vetores so crescem: mudar VARIA e voltar nao chama o heap
+    nPad = (n + 7) & ~7;
+    if(nPad > tab->cap)
     {
-        t = 0.0f;
-        for(j = 0; j < pMatriz->m; j++)
+        chamadasHeap += 4;
+        free(tab->peso);
+        free(tab->blocoPlanos);
+        tab->peso = (f4d*) malloc(nPad * sizeof(f4d));
+        tab->blocoPlanos = malloc(4 * nPad * sizeof(float) + 31);
+        if(!tab->peso || !tab->blocoPlanos)
         {
-                // calcula cada ponto: p(s, t) = S G P G^t T
+            printf("\n Error en alocacion de memoria para a tabela de pesos");
+            esvaziaTabela(tab);
+            return 0;
+        }
+        tab->cap = nPad;
+    }
+    for(h = 0; h < 4; h++)
+    {
+        tab->plano[h] = (float*) ALINHA((size_t) tab->blocoPlanos) + h * tab->cap;
+        memset(tab->plano[h] + n, 0, (nPad - n) * sizeof(float));
+    }
+    tab->n = n;
 
-            prod_VetParam_MatBase(s, tmp, vsm);    // vsm = S G
-            prod_VetParam_MatBase(t, tmp, vtm);    // vtm = G^t T
+    s = 0.0f;
+    for(k = 0; k < n; k++)
+    {
+        if(nSeg > 0) s = (float) k / nSeg;
+        if(derivada) prod_VetParamDeriv_Bezier(s, tmp, tab->peso[k]);
+        else prod_VetParam_Bezier(s, tmp, tab->peso[k]);
+        for(h = 0; h < 4; h++)
+            tab->plano[h][k] = tab->peso[k][h];
+        s += VARIA;
+    }
 
-            prod_VetMatriz(vsm, pcPatch->ponto, va);    // va = S G P = vsm P
+    tab->varia = passo;
+    tab->nSeg = nSeg;
+    return 1;
+}
 
-            pMatriz->ponto[i][j][0] = 0.0f;
-            pMatriz->ponto[i][j][1] = 0.0f;
-            pMatriz->ponto[i][j][2] = 0.0f;
+// sem a tabela de derivadas a de posicoes tambem fica vazia, para ser
+// montada de novo na proxima chamada
+static int preencheTabela(tabelaPesos *tab, int nSeg)
+{
+    if(!preencheTabelaPesos(tab, nSeg, 0)) return 0;
 
-            for(h=0; h<4; h++)                        // p = S G P G^t T = va vtm
-            {
-                pMatriz->ponto[i][j][0] += va[h][0] * vtm[h];
-                pMatriz->ponto[i][j][1] += va[h][1] * vtm[h];
-                pMatriz->ponto[i][j][2] += va[h][2] * vtm[h];
-            }
-            t+=VARIA;
-        }
-        s+=VARIA;
+    if(!tab->deriv)
+    {
+        chamadasHeap++;
+        tab->deriv = (tabelaPesos*) calloc(1, sizeof(tabelaPesos));
+    }
+    if(!tab->deriv || !preencheTabelaPesos(tab->deriv, nSeg, 1))
+    {
+        if(!tab->deriv) printf("\n Error en alocacion de memoria para a tabela de pesos");
+        esvaziaTabela(tab);
+        return 0;
     }
+    return 1;
+}
+
+// recalcula a tabela de pesos so quando VARIA muda; 0 se faltar memoria
+int AtualizaTabelaPesos(tabelaPesos *tab)
+{
+    if(tab->peso && tab->varia == VARIA)
+        return 1;
 
+    return preencheTabela(tab, 0);
 }
 
-// calcula normal de triângulo (v0,v1,v2) e normaliza
-void calcNormalTri(float v0[3], float v1[3], float v2[3], float n[3])
+// tabela com nSeg segmentos exatos, criada sob demanda; NULL se faltar
+// memoria (as tabelas anteriores continuam valendo)
+tabelaPesos* TabelaSegmentos(int nSeg)
 {
-    float a[3], b[3];
-    a[X] = v1[X] - v0[X];
-    a[Y] = v1[Y] - v0[Y];
-    a[Z] = v1[Z] - v0[Z];
+    int k, novo;
+    tabelaPesos *tabs;
 
-    b[X] = v2[X] - v0[X];
-    b[Y] = v2[Y] - v0[Y];
-    b[Z] = v2[Z] - v0[Z];
+    if(nSeg >= nTabSeg)
+    {
+        novo = nSeg + 1;
+        chamadasHeap++;
+        if((tabs = (tabelaPesos*) realloc(tabSeg, novo * sizeof(tabelaPesos))) == NULL)
+        {
+            printf("\n Error en alocacion de memoria para a tabela de %d segmentos", nSeg);
+            return NULL;
+        }
+        tabSeg = tabs;
+        for(k = nTabSeg; k < novo; k++)
+            memset(&tabSeg[k], 0, sizeof(tabelaPesos));
+        nTabSeg = novo;
+    }
 
-    n[X] = a[Y]*b[Z] - a[Z]*b[Y];
-    n[Y] = a[Z]*b[X] - a[X]*b[Z];
-    n[Z] = a[X]*b[Y] - a[Y]*b[X];
+    if(!tabSeg[nSeg].peso && !preencheTabela(&tabSeg[nSeg], nSeg))
+        return NULL;
 
-    float s = sqrt(n[X]*n[X] + n[Y]*n[Y] + n[Z]*n[Z]);
-    if(s == 0.0f) s = 1.0f;
-    n[X] /= s; n[Y] /= s; n[Z] /= s;
+    return &tabSeg[nSeg];
 }
 
-// calcula contribuição de uma luz (pos) para triângulo com normal n e centro c
-float luzContrib(const f4d posLight, float n[3], float c[3])
+// kernels de linha. Todos fazem as mesmas operacoes na mesma ordem
+// (p = 0 + va[0]*w0 + va[1]*w1 + ...), sem FMA, e por isso geram
+// exatamente os mesmos pontos; os vetoriais so avaliam 4 ou 8 amostras
+// de uma vez e deixam o resto da linha para um kernel mais estreito.
+static void linhaEscalarDesde(f4d va[4], const tabelaPesos *tab, int j, int m, f4d *linha)
 {
-    float L[3];
-    L[X] = posLight[X] - c[X];
-    L[Y] = posLight[Y] - c[Y];
-    L[Z] = posLight[Z] - c[Z];
-
-    float dist = sqrt(L[X]*L[X] + L[Y]*L[Y] + L[Z]*L[Z]);
-    if(dist == 0.0f) dist = 1.0f;
-    L[X] /= dist; L[Y] /= dist; L[Z] /= dist;
+    int h;
+    float *vtm;
 
-    float dot = n[X]*L[X] + n[Y]*L[Y] + n[Z]*L[Z];
-    if(dot < 0.0f) dot = 0.0f;
+    for(; j < m; j++)
+    {
+        vtm = tab->peso[j];                       // vtm = G^t T
 
-    // atenuação simples: 1 / (1 + k * d^2)
-    float k = 0.005f;
-    float att = 1.0f / (1.0f + k * dist * dist);
+        linha[j][0] = 0.0f;
+        linha[j][1] = 0.0f;
+        linha[j][2] = 0.0f;
 
-    return dot * att;
+        for(h=0; h<4; h++)                        // p = S G P G^t T = va vtm
+        {
+            linha[j][0] += va[h][0] * vtm[h];
+            linha[j][1] += va[h][1] * vtm[h];
+            linha[j][2] += va[h][2] * vtm[h];
+        }
+    }
 }
 
-void MostrarUmPatch(int cc)
+static void linhaEscalar(f4d va[4], const tabelaPesos *tab, int m, f4d *linha)
 {
-    int i, j;
-    float t,v,s;
-    f4d a,b,n,l;
+    linhaEscalarDesde(va, tab, 0, m, linha);
+}
 
-    if(!pMatriz)  return;
+#ifdef USA_SIMD_X86
+__attribute__((target("sse2")))
+static void linhaSSEDesde(f4d va[4], const tabelaPesos *tab, int j, int m, f4d *linha)
+{
+    int h;
+    __m128 vx[4], vy[4], vz[4], w, px, py, pz, pw;
 
-    switch(tipoView)
+    for(h=0; h<4; h++)
     {
-        case GL_POINTS:
-          glColor3f(0.0f, 0.0f, 0.7f);
-          glPointSize(1.0);
-          for(i = 0; i < pMatriz->n; i++)
-          {
-              glBegin(tipoView);
-              for(j = 0; j < pMatriz->m; j++)
-                 glVertex3fv(pMatriz->ponto[i][j]);
-              glEnd();
-          }
-          break;
-
-        case GL_LINE_STRIP:
-          glColor3f(0.0f, 0.0f, 0.7f);
-          for(i = 0; i < pMatriz->n; i++)
-          {
-              glBegin(tipoView);
-              for(j = 0; j < pMatriz->m; j++)
-                 glVertex3fv(pMatriz->ponto[i][j]);
-              glEnd();
-          }
-
-          for(j = 0; j < pMatriz->n; j++)
-          {
-              glBegin(tipoView);
-              for(i = 0; i < pMatriz->m; i++)
-                 glVertex3fv(pMatriz->ponto[i][j]);
-              glEnd();
-          }
-          break;
+        vx[h] = _mm_set1_ps(va[h][0]);
+        vy[h] = _mm_set1_ps(va[h][1]);
+        vz[h] = _mm_set1_ps(va[h][2]);
+    }
 
-        case GL_QUADS: // preserved for compatibility
-case GL_TRIANGLES:
-{
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    for(; j + 4 <= m; j += 4)
+    {
+        px = py = pz = pw = _mm_setzero_ps();
+        for(h=0; h<4; h++)
+        {
+            w = _mm_load_ps(tab->plano[h] + j);
+            px = _mm_add_ps(px, _mm_mul_ps(vx[h], w));
+            py = _mm_add_ps(py, _mm_mul_ps(vy[h], w));
+            pz = _mm_add_ps(pz, _mm_mul_ps(vz[h], w));
+        }
 
-    // percorre a malha, gerando triângulos diretos
-    for (int i = 0; i < pMatriz->n - 1; i++) {
-        for (int j = 0; j < pMatriz->m - 1; j++) {
+        // x x x x / y y y y / z z z z -> 4 pontos f4d
+        _MM_TRANSPOSE4_PS(px, py, pz, pw);
+        _mm_storeu_ps(linha[j],   px);
+        _mm_storeu_ps(linha[j+1], py);
+        _mm_storeu_ps(linha[j+2], pz);
+        _mm_storeu_ps(linha[j+3], pw);
+    }
 
-            // obtém os 4 vértices do quadrado atual (ainda necessários para formar os 2 triângulos)
-            float v00[3] = { pMatriz->ponto[i][j][X],     pMatriz->ponto[i][j][Y],     pMatriz->ponto[i][j][Z]     };
-            float v01[3] = { pMatriz->ponto[i][j+1][X],   pMatriz->ponto[i][j+1][Y],   pMatriz->ponto[i][j+1][Z]   };
-            float v10[3] = { pMatriz->ponto[i+1][j][X],   pMatriz->ponto[i+1][j][Y],   pMatriz->ponto[i+1][j][Z]   };
-            float v11[3] = { pMatriz->ponto[i+1][j+1][X], pMatriz->ponto[i+1][j+1][Y], pMatriz->ponto[i+1][j+1][Z] };
+    linhaEscalarDesde(va, tab, j, m, linha);
+}
 
-            // ===== Triângulo 1: v00, v01, v11 =====
-            float nA[3];
-            calcNormalTri(v00, v01, v11, nA);
+static void linhaSSE(f4d va[4], const tabelaPesos *tab, int m, f4d *linha)
+{
+    linhaSSEDesde(va, tab, 0, m, linha);
+}
 
-            float cA[3] = {
-                (v00[X] + v01[X] + v11[X]) / 3.0f,
-                (v00[Y] + v01[Y] + v11[Y]) / 3.0f,
-                (v00[Z] + v01[Z] + v11[Z]) / 3.0f
-            };
+__attribute__((target("avx2")))
+static void linhaAVX2(f4d va[4], const tabelaPesos *tab, int m, f4d *linha)
+{
+    int j, h;
+    __m256 vx[4], vy[4], vz[4], w, px, py, pz;
+    __m128 ax, ay, az, aw;
 
-            float ambient = 0.25f;
-            float contribA = ambient
-                + luzContrib(lightPos1, nA, cA)
-                + 0.6f * luzContrib(lightPos2, nA, cA);
+    for(h=0; h<4; h++)
+    {
+        vx[h] = _mm256_set1_ps(va[h][0]);
+        vy[h] = _mm256_set1_ps(va[h][1]);
+        vz[h] = _mm256_set1_ps(va[h][2]);
+    }
 
-            contribA = fminf(contribA, 1.0f);
+    for(j = 0; j + 8 <= m; j += 8)
+    {
+        px = py = pz = _mm256_setzero_ps();
+        for(h=0; h<4; h++)
+        {
+            w = _mm256_load_ps(tab->plano[h] + j);
+            px = _mm256_add_ps(px, _mm256_mul_ps(vx[h], w));
+            py = _mm256_add_ps(py, _mm256_mul_ps(vy[h], w));
+            pz = _mm256_add_ps(pz, _mm256_mul_ps(vz[h], w));
+        }
 
-            glBegin(GL_TRIANGLES);
-                glColor3f(contribA * vcolor[cc][X],
-                          contribA * vcolor[cc][Y],
-                          contribA * vcolor[cc][Z]);
-                glNormal3fv(nA);
-                glVertex3fv(v00);
-                glVertex3fv(v01);
-                glVertex3fv(v11);
-            glEnd();
+        ax = _mm256_castps256_ps128(px);
+        ay = _mm256_castps256_ps128(py);
+        az = _mm256_castps256_ps128(pz);
+        aw = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+        _mm_storeu_ps(linha[j],   ax);
+        _mm_storeu_ps(linha[j+1], ay);
+        _mm_storeu_ps(linha[j+2], az);
+        _mm_storeu_ps(linha[j+3], aw);
+
+        ax = _mm256_extractf128_ps(px, 1);
+        ay = _mm256_extractf128_ps(py, 1);
+        az = _mm256_extractf128_ps(pz, 1);
+        aw = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+        _mm_storeu_ps(linha[j+4], ax);
+        _mm_storeu_ps(linha[j+5], ay);
+        _mm_storeu_ps(linha[j+6], az);
+        _mm_storeu_ps(linha[j+7], aw);
+    }
+    _mm256_zeroupper();
 
-            // ===== Triângulo 2: v00, v11, v10 =====
-            float nB[3];
-            calcNormalTri(v00, v11, v10, nB);
+    linhaSSEDesde(va, tab, j, m, linha);
+}
+#endif
+
+// diferencas progressivas: com t avancando em passos constantes h = VARIA,
+// p(t) = a t^3 + b t^2 + c t + d vira tres somas por coordenada e por
+// amostra. As diferencas sao reiniciadas a partir de va em cada linha,
+// o que limita o erro acumulado ao comprimento de uma linha. Os patches
+// ja estao na forma de Bezier, cuja matriz o compilador dobra.
+static void linhaDiferencas(f4d va[4], const tabelaPesos *tab, int m, f4d *linha)
+{
+    int j, k;
+    float cf[4], hh;
+    f4d f, d1, d2, d3;
 
-            float cB[3] = {
-                (v00[X] + v11[X] + v10[X]) / 3.0f,
-                (v00[Y] + v11[Y] + v10[Y]) / 3.0f,
-                (v00[Z] + v11[Z] + v10[Z]) / 3.0f
-            };
+    hh = tab->varia;
 
-            float contribB = ambient
-                + luzContrib(lightPos1, nB, cB)
-                + 0.6f * luzContrib(lightPos2, nB, cB);
+    for(k = 0; k < 3; k++)
+    {
+        // coeficientes em potencias de t: cf[i] = sum_b base[i][b] va[b]
+        spline::potencias<SPLINE_BEZIER>(va, k, cf);
 
-            contribB = fminf(contribB, 1.0f);
+        f[k]  = cf[3];
+        d1[k] = cf[0]*hh*hh*hh + cf[1]*hh*hh + cf[2]*hh;
+        d2[k] = 6.0f*cf[0]*hh*hh*hh + 2.0f*cf[1]*hh*hh;
+        d3[k] = 6.0f*cf[0]*hh*hh*hh;
+    }
+    f[3] = d1[3] = d2[3] = d3[3] = 0.0f;
 
-            glBegin(GL_TRIANGLES);
-                glColor3f(contribB * vcolor[cc][X],
-                          contribB * vcolor[cc][Y],
-                          contribB * vcolor[cc][Z]);
-                glNormal3fv(nB);
-                glVertex3fv(v00);
-                glVertex3fv(v11);
-                glVertex3fv(v10);
-            glEnd();
+    // x, y e z avancam juntos (o compilador usa um registrador de 4 floats)
+    for(j = 0; j < m; j++)
+    {
+        for(k = 0; k < 4; k++)
+        {
+            linha[j][k] = f[k];
+            f[k]  += d1[k];
+            d1[k] += d2[k];
+            d2[k] += d3[k];
         }
     }
-    break;
 }
 
-    }
+// calcula contribuição de uma luz (pos) para triângulo com normal n e centro c;
+// k é o coeficiente de atenuação
+float luzContrib(const f4d posLight, float n[3], float c[3], float k)
+{
+    float L[3];
+    L[X] = posLight[X] - c[X];
+    L[Y] = posLight[Y] - c[Y];
+    L[Z] = posLight[Z] - c[Z];
+
+    float dist = sqrt(L[X]*L[X] + L[Y]*L[Y] + L[Z]*L[Z]);
+    if(dist == 0.0f) dist = 1.0f;
+    L[X] /= dist; L[Y] /= dist; L[Z] /= dist;
+
+    float dot = n[X]*L[X] + n[Y]*L[Y] + n[Z]*L[Z];
+    if(dot < 0.0f) dot = 0.0f;
 
+    // atenuação simples: 1 / (1 + k * d^2)
+    float att = 1.0f / (1.0f + k * dist * dist);
+
+    return dot * att;
 }
 
-void MostrarPtosPoligControle(matriz *sup)
+// kernels de iluminacao em lote: todas as luzes para um bloco de vertices.
+// Os vetoriais transpoem 4 (ou 8) vertices para x x x x / y y y y / ... e
+// avaliam luzContrib em todos de uma vez; o resto do vetor fica com o
+// escalar.
+static void luzEscalarDesde(const f4d *pos, const f4d *normal, int v, int n,
+                            const fonteLuz *fontes, int nf, float katt, float *luz)
 {
-    int i, j;
+    int k;
+    float soma;
 
-    glColor3f(0.0f, 0.8f, 0.0f);
-    glPolygonMode(GL_FRONT_AND_BACK, tipoView);
-    glPointSize(7.0);
-    for(i=0; i<sup->n; i++)
+    for(; v < n; v++)
     {
-        glBegin(GL_POINTS);
-        for(j=0; j<sup->m; j++)
-            glVertex3fv(sup->ponto[i][j]);
-        glEnd();
+        soma = luzAmbiente;
+        for(k = 0; k < nf; k++)
+            soma += fontes[k].peso * luzContrib(fontes[k].pos, (float*) normal[v], (float*) pos[v], katt);
 
-        glBegin(GL_LINE_STRIP);
-        for(j=0; j<sup->m; j++)
-            glVertex3fv(sup->ponto[i][j]);
-        glEnd();
+        luz[v] = fminf(soma, 1.0f);
     }
+}
 
-    for(i=0; i<sup->m; i++)
-    {
-        glBegin(GL_LINE_STRIP);
-        for(j=0; j<sup->n; j++)
-            glVertex3fv(sup->ponto[j][i]);
-        glEnd();
-    }
+static void luzEscalar(const f4d *pos, const f4d *normal, int n,
+                       const fonteLuz *fontes, int nf, float katt, float *luz)
+{
+    luzEscalarDesde(pos, normal, 0, n, fontes, nf, katt, luz);
 }
 
-void copiarPtosControlePatch(int i0, int j0)
+#ifdef USA_SIMD_X86
+__attribute__((target("sse2")))
+static void luzSSEDesde(const f4d *pos, const f4d *normal, int v, int n,
+                        const fonteLuz *fontes, int nf, float katt, float *luz)
 {
-    int i, j, jj, ii;
+    int k;
+    __m128 px, py, pz, pw, nx, ny, nz, nw, lx, ly, lz, dist, dot, att, soma;
+    const __m128 zero = _mm_setzero_ps(), um = _mm_set1_ps(1.0f);
+    const __m128 ka = _mm_set1_ps(katt);
 
-    for(i=0; i<pcPatch->n; i++)
+    for(; v + 4 <= n; v += 4)
     {
-        ii = (i0 + i)%(pc->n);
-        for(j=0; j<pcPatch->m; j++)
+        px = _mm_loadu_ps(pos[v]);
+        py = _mm_loadu_ps(pos[v+1]);
+        pz = _mm_loadu_ps(pos[v+2]);
+        pw = _mm_loadu_ps(pos[v+3]);
+        _MM_TRANSPOSE4_PS(px, py, pz, pw);
+
+        nx = _mm_loadu_ps(normal[v]);
+        ny = _mm_loadu_ps(normal[v+1]);
+        nz = _mm_loadu_ps(normal[v+2]);
+        nw = _mm_loadu_ps(normal[v+3]);
+        _MM_TRANSPOSE4_PS(nx, ny, nz, nw);
+
+        soma = _mm_set1_ps(luzAmbiente);
+        for(k = 0; k < nf; k++)
         {
-            jj = (j0 + j)%(pc->m);
-            pcPatch->ponto[i][j][0] = pc->ponto[ii][jj][0];
-            pcPatch->ponto[i][j][1] = pc->ponto[ii][jj][1];
-            pcPatch->ponto[i][j][2] = pc->ponto[ii][jj][2];
+            lx = _mm_sub_ps(_mm_set1_ps(fontes[k].pos[X]), px);
+            ly = _mm_sub_ps(_mm_set1_ps(fontes[k].pos[Y]), py);
+            lz = _mm_sub_ps(_mm_set1_ps(fontes[k].pos[Z]), pz);
+
+            dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)),
+                                          _mm_mul_ps(lz, lz)));
+            // dist == 0 -> 1, como em luzContrib
+            dist = _mm_or_ps(dist, _mm_and_ps(_mm_cmpeq_ps(dist, zero), um));
+
+            lx = _mm_div_ps(lx, dist);
+            ly = _mm_div_ps(ly, dist);
+            lz = _mm_div_ps(lz, dist);
+            dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+            dot = _mm_max_ps(dot, zero);
+
+            att = _mm_div_ps(um, _mm_add_ps(um, _mm_mul_ps(_mm_mul_ps(ka, dist), dist)));
+            soma = _mm_add_ps(soma, _mm_mul_ps(_mm_set1_ps(fontes[k].peso), _mm_mul_ps(dot, att)));
         }
+        _mm_storeu_ps(luz + v, _mm_min_ps(soma, um));
     }
+
+    luzEscalarDesde(pos, normal, v, n, fontes, nf, katt, luz);
 }
 
-void DisenaSuperficie(void)
+static void luzSSE(const f4d *pos, const f4d *normal, int n,
+                   const fonteLuz *fontes, int nf, float katt, float *luz)
+{
+    luzSSEDesde(pos, normal, 0, n, fontes, nf, katt, luz);
+}
+
+// 8 vertices: dois blocos 4x4 transpostos nas metades do registrador
+__attribute__((target("avx2")))
+static inline void carrega8(const f4d *p, __m256 *x, __m256 *y, __m256 *z)
 {
-    int i, j, nn;
+    __m128 a0, a1, a2, a3, b0, b1, b2, b3;
+
+    a0 = _mm_loadu_ps(p[0]); a1 = _mm_loadu_ps(p[1]);
+    a2 = _mm_loadu_ps(p[2]); a3 = _mm_loadu_ps(p[3]);
+    b0 = _mm_loadu_ps(p[4]); b1 = _mm_loadu_ps(p[5]);
+    b2 = _mm_loadu_ps(p[6]); b3 = _mm_loadu_ps(p[7]);
+    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+    _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+    *x = _mm256_set_m128(b0, a0);
+    *y = _mm256_set_m128(b1, a1);
+    *z = _mm256_set_m128(b2, a2);
+}
 
-    nn = pc->n - 3;   // numero de descolamentos (patchs)
+__attribute__((target("avx2")))
+static void luzAVX2(const f4d *pos, const f4d *normal, int n,
+                    const fonteLuz *fontes, int nf, float katt, float *luz)
+{
+    int v, k;
+    __m256 px, py, pz, nx, ny, nz, lx, ly, lz, dist, dot, att, soma;
+    const __m256 zero = _mm256_setzero_ps(), um = _mm256_set1_ps(1.0f);
+    const __m256 ka = _mm256_set1_ps(katt);
 
-    for (i=0; i<nn; i++)
+    for(v = 0; v + 8 <= n; v += 8)
     {
-        for(j=0; j<pc->m; j++)
+        carrega8(pos + v, &px, &py, &pz);
+        carrega8(normal + v, &nx, &ny, &nz);
+
+        soma = _mm256_set1_ps(luzAmbiente);
+        for(k = 0; k < nf; k++)
         {
-            copiarPtosControlePatch(i, j);
-            ptsSuperficie();
-            MostrarUmPatch((i+j)%4);
+            lx = _mm256_sub_ps(_mm256_set1_ps(fontes[k].pos[X]), px);
+            ly = _mm256_sub_ps(_mm256_set1_ps(fontes[k].pos[Y]), py);
+            lz = _mm256_sub_ps(_mm256_set1_ps(fontes[k].pos[Z]), pz);
+
+            dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx),
+                                                              _mm256_mul_ps(ly, ly)),
+                                                _mm256_mul_ps(lz, lz)));
+            dist = _mm256_or_ps(dist, _mm256_and_ps(_mm256_cmp_ps(dist, zero, _CMP_EQ_OQ), um));
+
+            lx = _mm256_div_ps(lx, dist);
+            ly = _mm256_div_ps(ly, dist);
+            lz = _mm256_div_ps(lz, dist);
+            dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, lx), _mm256_mul_ps(ny, ly)),
+                                _mm256_mul_ps(nz, lz));
+            dot = _mm256_max_ps(dot, zero);
+
+            att = _mm256_div_ps(um, _mm256_add_ps(um, _mm256_mul_ps(_mm256_mul_ps(ka, dist), dist)));
+            soma = _mm256_add_ps(soma, _mm256_mul_ps(_mm256_set1_ps(fontes[k].peso),
+                                                     _mm256_mul_ps(dot, att)));
         }
+        _mm256_storeu_ps(luz + v, _mm256_min_ps(soma, um));
     }
+    _mm256_zeroupper();
+
+    luzSSEDesde(pos, normal, v, n, fontes, nf, katt, luz);
 }
+#endif
 
+// kernel de linha do modo de avaliacao atual
+static kernelLinha kernelAtivo(void)
+{
+    return modoAvaliacao == AVAL_DIFERENCAS ? linhaDiferencas : kernelLinhaSup;
+}
 
-static void init(void)
+// escolhe o melhor kernel suportado pela CPU, limitado a nivelMax
+// (KERNEL_ESCALAR forca o caminho escalar)
+void EscolheKernelSuperficie(int nivelMax)
 {
+    kernelLinhaSup = linhaEscalar;
+    kernelIluminacao = luzEscalar;
+    nivelKernel = KERNEL_ESCALAR;
 
-   glClearColor(1.0, 1.0, 1.0, 0.0);
-   glEnable(GL_DEPTH_TEST);
-   // Mantemos shading manual (calculado por triângulo), então não habilitamos GL_LIGHTING automático.
-   glEnable(GL_MAP2_VERTEX_3);
-   glEnable(GL_AUTO_NORMAL);
-   glMapGrid2f(20, 0.0, 1.0, 20, 0.0, 1.0);
+#ifdef USA_SIMD_X86
+    __builtin_cpu_init();
+    if(nivelMax >= KERNEL_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+        kernelLinhaSup = linhaAVX2;
+        kernelIluminacao = luzAVX2;
+        nivelKernel = KERNEL_AVX2;
+    }
+    else if(nivelMax >= KERNEL_SSE && __builtin_cpu_supports("sse2"))
+    {
+        kernelLinhaSup = linhaSSE;
+        kernelIluminacao = luzSSE;
+        nivelKernel = KERNEL_SSE;
+    }
+#endif
 }
 
-void display(void)
+// avalia o patch ptsPatch (4x4 pontos de controle) nas primeiras nS amostras
+// de tabS (linhas, s) e nT de tabT (colunas, t), escrevendo a linha i em
+// dest + i*passo. Se destNormal nao for NULL, o mesmo passe calcula
+// dp/ds = S' G P G^t T e dp/dt = S G P G^t T' com as tabelas de derivadas
+// e grava a normal unitaria dp/dt x dp/ds (o mesmo sentido da normal dos
+// triangulos) em destNormal + i*passo; devolve quantas normais ficaram
+// indefinidas (derivada nula, ex.: polo de um patch degenerado), ou -1
+// se faltar memoria para as derivadas. Nao usa
+// estado global mutavel, entao varios patches podem ser avaliados em
+// paralelo depois que as tabelas e o kernel estiverem prontos.
+int ptsSuperficie(matriz *ptsPatch, const tabelaPesos *tabS, const tabelaPesos *tabT,
+                  int nS, int nT, f4d *dest, f4d *destNormal, int passo)
 {
-   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    static thread_local f4d *ds = NULL, *dt = NULL;
+    static thread_local int capDer = 0;
+    int i, j, degeneradas = 0;
+    f4d va[4], vas[4];
+    float *n, len;
+    kernelLinha kernel;
 
-   glPushMatrix();
+    kernel = kernelAtivo();
 
-   if(pc)
+    if(destNormal && capDer < nT)
+    {
+        chamadasHeap += 4;
+        free(ds);
+        free(dt);
+        ds = (f4d*) malloc(nT * sizeof(f4d));
+        dt = (f4d*) malloc(nT * sizeof(f4d));
+        if(!ds || !dt)
+        {
+            printf("\n Error en alocacion de memoria para as derivadas");
+            free(ds);
+            free(dt);
+            ds = dt = NULL;
+            capDer = 0;
+            return -1;
+        }
+        capDer = nT;
+    }
+
+    // calcula cada ponto: p(s, t) = S G P G^t T
+    for(i = 0; i < nS; i++)
+    {
+        // va = S G P = vsm P depende so de s: uma vez por linha
+        prod_VetMatriz(tabS->peso[i], ptsPatch->ponto, va);
+
+        kernel(va, tabT, nT, dest + (size_t)i * passo);
+
+        if(!destNormal) continue;
+
+        // derivadas sempre pela forma matricial (as diferencas
+        // progressivas so valem para o polinomio da posicao)
+        prod_VetMatriz(tabS->deriv->peso[i], ptsPatch->ponto, vas);
+        kernelLinhaSup(vas, tabT, nT, ds);
+        kernelLinhaSup(va, tabT->deriv, nT, dt);
+
+        for(j = 0; j < nT; j++)
+        {
+            n = destNormal[(size_t)i * passo + j];
+            n[X] = dt[j][Y]*ds[j][Z] - dt[j][Z]*ds[j][Y];
+            n[Y] = dt[j][Z]*ds[j][X] - dt[j][X]*ds[j][Z];
+            n[Z] = dt[j][X]*ds[j][Y] - dt[j][Y]*ds[j][X];
+            n[3] = 0.0f;
+
+            // derivadas nulas ou paralelas (a menos de arredondamento)
+            // nao definem a normal
+            len = sqrtf(n[X]*n[X] + n[Y]*n[Y] + n[Z]*n[Z]);
+            if(len > 1e-4f * (ds[j][X]*ds[j][X] + ds[j][Y]*ds[j][Y] + ds[j][Z]*ds[j][Z] +
+                              dt[j][X]*dt[j][X] + dt[j][Y]*dt[j][Y] + dt[j][Z]*dt[j][Z]))
+            {
+                n[X] /= len; n[Y] /= len; n[Z] /= len;
+            }
+            else
+            {
+                n[X] = n[Y] = n[Z] = 0.0f;
+                degeneradas++;
+            }
+        }
+    }
+    return degeneradas;
+}
+
+// numero de segmentos para que a corda fique abaixo de tol em cada direcao.
+// ptsPatch esta na forma de Bezier (ConvertePatches).
+// Com C = MBezier P MBezier^t o patch e p(s,t) = sum s^(3-a) t^(3-b) C[a][b],
+// entao |p_ss| <= sum_b (6|C[0][b]| + 2|C[1][b]|) em [0,1]^2 (idem p_tt), e
+// uma grade com passo h tem erro de corda <= h^2 max|p''| / 8.
+void SegmentosPatch(matriz *ptsPatch, float tol, int maxSeg, int *ns, int *nt)
+{
+    int k, h;
+    f4d C[4][4];
+    float bs[3], bt[3], ds, dt;
+
+    spline::coeficientesPatch<SPLINE_BEZIER>(ptsPatch->ponto, C);
+
+    for(h = 0; h < 3; h++)
+    {
+        bs[h] = bt[h] = 0.0f;
+        for(k = 0; k < 4; k++)
+        {
+            bs[h] += 6.0f*fabsf(C[0][k][h]) + 2.0f*fabsf(C[1][k][h]);
+            bt[h] += 6.0f*fabsf(C[k][0][h]) + 2.0f*fabsf(C[k][1][h]);
+        }
+    }
+
+    ds = sqrtf(bs[X]*bs[X] + bs[Y]*bs[Y] + bs[Z]*bs[Z]);
+    dt = sqrtf(bt[X]*bt[X] + bt[Y]*bt[Y] + bt[Z]*bt[Z]);
+
+    *ns = (int) ceilf(sqrtf(ds / (8.0f * tol)));
+    *nt = (int) ceilf(sqrtf(dt / (8.0f * tol)));
+
+    if(*ns < 1) *ns = 1;
+    if(*nt < 1) *nt = 1;
+    if(*ns > maxSeg) *ns = maxSeg;
+    if(*nt > maxSeg) *nt = maxSeg;
+}
+
+// LOD de tela: segmentos de um patch pelo tamanho na janela (diagonal da
+// caixa envolvente projetada) dos seus 16 pontos de Bezier, cujo fecho
+// convexo contem o patch em qualquer base. Os niveis sao potencias de 2,
+// entao girar o objeto raramente muda a malha.
+int SegmentosTela(matriz *ptsPatch, int maxSeg)
+{
+    int a, b, h, n;
+    float p, lo[2], hi[2], tam;
+    float *q;
+
+    for(h = 0; h < 2; h++)
+    {
+        lo[h] = FLT_MAX;
+        hi[h] = -FLT_MAX;
+    }
+
+    for(a = 0; a < 4; a++)
+        for(b = 0; b < 4; b++)
+        {
+            q = ptsPatch->ponto[a][b];
+            for(h = 0; h < 2; h++)
+            {
+                p = q[X] * matModelo[X][h] + q[Y] * matModelo[Y][h] + q[Z] * matModelo[Z][h];
+                if(p < lo[h]) lo[h] = p;
+                if(p > hi[h]) hi[h] = p;
+            }
+        }
+
+    tam = sqrtf((hi[X]-lo[X])*(hi[X]-lo[X]) + (hi[Y]-lo[Y])*(hi[Y]-lo[Y])) * pixelsPorUnidade;
+
+    for(n = 1; n < maxSeg && n * pixelsSegmento < tam; n *= 2);
+    return n < maxSeg ? n : maxSeg;
+}
+
+// calcula normal de triângulo (v0,v1,v2) e normaliza
+void calcNormalTri(float v0[3], float v1[3], float v2[3], float n[3])
+{
+    float a[3], b[3];
+    a[X] = v1[X] - v0[X];
+    a[Y] = v1[Y] - v0[Y];
+    a[Z] = v1[Z] - v0[Z];
+
+    b[X] = v2[X] - v0[X];
+    b[Y] = v2[Y] - v0[Y];
+    b[Z] = v2[Z] - v0[Z];
+
+    n[X] = a[Y]*b[Z] - a[Z]*b[Y];
+    n[Y] = a[Z]*b[X] - a[X]*b[Z];
+    n[Z] = a[X]*b[Y] - a[Y]*b[X];
+
+    float s = sqrt(n[X]*n[X] + n[Y]*n[Y] + n[Z]*n[Z]);
+    if(s == 0.0f) s = 1.0f;
+    n[X] /= s; n[Y] /= s; n[Z] /= s;
+}
+
+// ---- perfil por quadro ----
+// Tempo de cada etapa do display(), acumulado no quadro e guardado numa
+// janela dos ultimos QUADROS_PERFIL quadros (min/media/p99). Desligado,
+// cada ponto de medida custa so o teste de perfilAtivo. A avaliacao e
+// medida dentro das tarefas do pool e somada entre as threads; o envio
+// mede o lado da CPU das chamadas OpenGL (sem glFinish).
+#define ETAPA_CONTROLE    0   // desenho da rede de controle
+#define ETAPA_CONVERSAO   1   // patches para a forma de Bezier
+#define ETAPA_AVALIACAO   2   // ptsSuperficie
+#define ETAPA_ILUMINACAO  3   // normais degeneradas e iluminacao
+#define ETAPA_ENVIO       4   // montagem dos buffers e chamadas de desenho
+#define ETAPA_QUADRO      5   // display() inteiro
+#define NUM_ETAPAS        6
+
+#define QUADROS_PERFIL  256
+
+const char *nomeEtapa[NUM_ETAPAS] = {"controle", "conversao", "avaliacao", "iluminacao", "envio", "quadro"};
+
+int perfilAtivo = 0;          // mede as etapas (overlay ou arquivo)
+int perfilOverlay = 0;        // mostra as estatisticas na janela
+
+std::atomic<long long> nsEtapa[NUM_ETAPAS];      // acumulado do quadro atual
+float msEtapa[NUM_ETAPAS][QUADROS_PERFIL];        // janela circular, em ms
+int nQuadrosPerfil = 0;                           // quadros medidos
+long long heapInicioQuadro;                       // chamadasHeap no inicio do quadro
+int heapQuadro[QUADROS_PERFIL];                   // chamadas ao heap de cada quadro
+
+FILE *arqPerfil = NULL;
+int perfilJson = 0;
+
+static inline long long nsAgora(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// inicio de uma medida: 0 (sem ler o relogio) com o perfil desligado
+static inline long long InicioEtapa(void)
+{
+    return perfilAtivo ? nsAgora() : 0;
+}
+
+static inline void FimEtapa(int etapa, long long t0)
+{
+    if(perfilAtivo) nsEtapa[etapa] += nsAgora() - t0;
+}
+
+typedef struct st_estatEtapa
+{
+    float min, media, p99;
+} estatEtapa;
+
+static int comparaFloat(const void *a, const void *b)
+{
+    float x = *(const float*) a, y = *(const float*) b;
+    return (x > y) - (x < y);
+}
+
+// min, media e p99 da janela de uma etapa
+static void EstatisticaEtapa(int etapa, estatEtapa *e)
+{
+    float v[QUADROS_PERFIL];
+    int k, n;
+
+    n = nQuadrosPerfil < QUADROS_PERFIL ? nQuadrosPerfil : QUADROS_PERFIL;
+    e->min = e->media = e->p99 = 0.0f;
+    if(n == 0) return;
+
+    memcpy(v, msEtapa[etapa], n * sizeof(float));
+    qsort(v, n, sizeof(float), comparaFloat);
+    for(k = 0; k < n; k++) e->media += v[k];
+    e->media /= n;
+    e->min = v[0];
+    e->p99 = v[(int)(0.99f * (n - 1) + 0.5f)];
+}
+
+static void FechaArquivoPerfil(void)
+{
+    if(!arqPerfil) return;
+    if(perfilJson) fprintf(arqPerfil, "\n]\n");
+    fclose(arqPerfil);
+    arqPerfil = NULL;
+}
+
+// -perfil arq: .json grava um vetor de objetos, qualquer outro nome CSV
+int AbreArquivoPerfil(const char *nome)
+{
+    const char *ext = strrchr(nome, '.');
+    int k;
+
+    if((arqPerfil = fopen(nome, "w")) == NULL)
+    {
+        printf("Erro ao criar o arquivo %s \n", nome);
+        return 0;
+    }
+
+    perfilJson = ext && strcmp(ext, ".json") == 0;
+    if(perfilJson) fprintf(arqPerfil, "[");
+    else
+    {
+        fprintf(arqPerfil, "quadro");
+        for(k = 0; k < NUM_ETAPAS; k++) fprintf(arqPerfil, ",%s_ms", nomeEtapa[k]);
+        fprintf(arqPerfil, ",heap\n");
+    }
+
+    perfilAtivo = 1;
+    atexit(FechaArquivoPerfil);
+    return 1;
+}
+
+static void ZeraQuadroPerfil(void)
+{
+    int k;
+
+    for(k = 0; k < NUM_ETAPAS; k++) nsEtapa[k] = 0;
+    heapInicioQuadro = chamadasHeap;
+}
+
+// fecha o quadro: guarda na janela e grava uma linha no arquivo
+static void FechaQuadroPerfil(void)
+{
+    int k, q;
+
+    if(!perfilAtivo) return;
+
+    q = nQuadrosPerfil % QUADROS_PERFIL;
+    for(k = 0; k < NUM_ETAPAS; k++) msEtapa[k][q] = nsEtapa[k] * 1e-6f;
+    heapQuadro[q] = (int)(chamadasHeap - heapInicioQuadro);
+
+    if(arqPerfil)
+    {
+        if(perfilJson)
+        {
+            fprintf(arqPerfil, "%s\n  {\"quadro\": %d", nQuadrosPerfil ? "," : "", nQuadrosPerfil);
+            for(k = 0; k < NUM_ETAPAS; k++) fprintf(arqPerfil, ", \"%s_ms\": %.4f", nomeEtapa[k], msEtapa[k][q]);
+            fprintf(arqPerfil, ", \"heap\": %d}", heapQuadro[q]);
+        }
+        else
+        {
+            fprintf(arqPerfil, "%d", nQuadrosPerfil);
+            for(k = 0; k < NUM_ETAPAS; k++) fprintf(arqPerfil, ",%.4f", msEtapa[k][q]);
+            fprintf(arqPerfil, ",%d\n", heapQuadro[q]);
+        }
+    }
+    nQuadrosPerfil++;
+}
+
+// texto no canto superior esquerdo, em coordenadas de janela
+static void MostrarOverlayPerfil(void)
+{
+    char texto[96];
+    const char *c;
+    estatEtapa e;
+    int k, w, h, n, soma;
+
+    w = glutGet(GLUT_WINDOW_WIDTH);
+    h = glutGet(GLUT_WINDOW_HEIGHT);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0.0, w, 0.0, h, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+
+    glColor3f(0.0f, 0.0f, 0.0f);
+    snprintf(texto, sizeof(texto), "%-10s %7s %7s %7s  (ms, %d quadros)", "etapa", "min", "media", "p99",
+             nQuadrosPerfil < QUADROS_PERFIL ? nQuadrosPerfil : QUADROS_PERFIL);
+    glRasterPos2i(8, h - 16);
+    for(c = texto; *c; c++) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+
+    for(k = 0; k < NUM_ETAPAS; k++)
+    {
+        EstatisticaEtapa(k, &e);
+        snprintf(texto, sizeof(texto), "%-10s %7.3f %7.3f %7.3f", nomeEtapa[k], e.min, e.media, e.p99);
+        glRasterPos2i(8, h - 32 - 14 * k);
+        for(c = texto; *c; c++) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+    }
+
+    // chamadas ao heap: do ultimo quadro e de toda a janela
+    n = nQuadrosPerfil < QUADROS_PERFIL ? nQuadrosPerfil : QUADROS_PERFIL;
+    for(k = 0, soma = 0; k < n; k++) soma += heapQuadro[k];
+    snprintf(texto, sizeof(texto), "%-10s %7d no quadro, %d na janela (arena %zu KB)", "heap",
+             n ? heapQuadro[(nQuadrosPerfil - 1) % QUADROS_PERFIL] : 0, soma, arenaQuadro.tam / 1024);
+    glRasterPos2i(8, h - 32 - 14 * NUM_ETAPAS);
+    for(c = texto; *c; c++) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+
+    glEnable(GL_DEPTH_TEST);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// geometria pronta para o OpenGL. Com VBO (OpenGL 1.5) os vetores sao
+// enviados uma vez a placa e so reenviados quando a geometria muda; sem
+// VBO os mesmos vetores sao desenhados direto da memoria (vertex arrays).
+// O modo solido usa 3 vertices proprios por triangulo (posicao, normal e
+// cor intercalados) porque cada triangulo leva a cor do seu patch.
+typedef struct st_buffersGL
+{
+    int usaVBO;
+    GLuint bSolido, bVert, bLin, bCtrl, bCtrlLin;
+    int geracaoSup, versaoCtrl, versaoModelo;
+    int nSolido, nVert, nLin, nCtrl, nCtrlLin, nLuz;
+    float *solido;            // 9 floats por vertice: x y z nx ny nz r g b
+    float *luz;               // iluminacao de cada vertice da malha
+    unsigned int *ctrlLin;    // arestas do poligono de controle
+    f4d *vert;                // vertices/arestas da malha (caminho sem VBO)
+    unsigned int *lin;
+    f4d *ctrl;
+    size_t tamSolido, tamLuz, tamCtrlLin;  // bytes reservados (Cresce)
+} buffersGL;
+
+// tudo zerado: a geracao do cache ja passou de 0 quando a malha e
+// desenhada, e nCtrl = 0 forca o primeiro envio dos pontos de controle
+buffersGL gpu = {};
+
+// deslocamento no buffer ligado (VBO) ou ponteiro na memoria (sem VBO)
+#define ENDERECO(base, bytes) (gpu.usaVBO ? (const void*)(size_t)(bytes) : (const void*)((const char*)(base) + (bytes)))
+
+void IniciaBuffersGL(void)
+{
+    const char *versao;
+    int maior = 1, menor = 0;
+
+    versao = (const char*) glGetString(GL_VERSION);
+    if(versao) sscanf(versao, "%d.%d", &maior, &menor);
+
+#ifdef USA_VBO
+    gpu.usaVBO = maior > 1 || (maior == 1 && menor >= 5);
+    if(gpu.usaVBO)
+    {
+        glGenBuffers(1, &gpu.bSolido);
+        glGenBuffers(1, &gpu.bVert);
+        glGenBuffers(1, &gpu.bLin);
+        glGenBuffers(1, &gpu.bCtrl);
+        glGenBuffers(1, &gpu.bCtrlLin);
+    }
+#endif
+    printf(" OpenGL %s: %s\n", versao ? versao : "?", gpu.usaVBO ? "VBO" : "vertex arrays");
+}
+
+static void enviaBuffer(GLenum alvo, GLuint buf, size_t bytes, const void *dados)
+{
+#ifdef USA_VBO
+    if(gpu.usaVBO)
+    {
+        glBindBuffer(alvo, buf);
+        glBufferData(alvo, bytes, dados, GL_STATIC_DRAW);
+        glBindBuffer(alvo, 0);
+    }
+#endif
+}
+
+static void enviaTrecho(GLenum alvo, GLuint buf, size_t desloc, size_t bytes, const void *dados)
+{
+#ifdef USA_VBO
+    if(gpu.usaVBO)
+    {
+        glBindBuffer(alvo, buf);
+        glBufferSubData(alvo, desloc, bytes, dados);
+        glBindBuffer(alvo, 0);
+    }
+#endif
+}
+
+static void ligaBuffer(GLenum alvo, GLuint buf)
+{
+#ifdef USA_VBO
+    if(gpu.usaVBO) glBindBuffer(alvo, buf);
+#endif
+}
+
+// leva as luzes para o espaco do objeto: pos * matModelo^-1. Com rotacoes
+// e escala uniforme s (as transformacoes das setas) a difusa nao muda e as
+// distancias do mundo sao s vezes as do objeto, entao a atenuacao fica
+// multiplicada por s^2.
+static void LuzesNoObjeto(fonteLuz *fontes, float *katt)
+{
+    int k, a, b;
+    float inv[3][3], det, s2;
+    const f4d *m = matModelo;
+
+    inv[0][0] = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    inv[0][1] = m[0][2]*m[2][1] - m[0][1]*m[2][2];
+    inv[0][2] = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+    inv[1][0] = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    inv[1][1] = m[0][0]*m[2][2] - m[0][2]*m[2][0];
+    inv[1][2] = m[0][2]*m[1][0] - m[0][0]*m[1][2];
+    inv[2][0] = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    inv[2][1] = m[0][1]*m[2][0] - m[0][0]*m[2][1];
+    inv[2][2] = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+    det = m[0][0]*inv[0][0] + m[0][1]*inv[1][0] + m[0][2]*inv[2][0];
+
+    for(k = 0; k < nLuzes; k++)
+    {
+        fontes[k] = luzes[k];
+        for(b = 0; b < 3; b++)
+        {
+            fontes[k].pos[b] = 0.0f;
+            for(a = 0; a < 3; a++)
+                fontes[k].pos[b] += luzes[k].pos[a] * inv[a][b];
+            fontes[k].pos[b] /= det;
+        }
+    }
+
+    s2 = m[0][0]*m[0][0] + m[0][1]*m[0][1] + m[0][2]*m[0][2];
+    *katt = ATENUACAO * s2;
+}
+
+// iluminacao de cada vertice da malha com a normal analitica dele: um
+// passe so, antes de montar os vertices do modo solido
+static void IluminaVertices(malha *sup, float *luz)
+{
+    fonteLuz fontes[MAX_LUZES];
+    float katt;
+
+    LuzesNoObjeto(fontes, &katt);
+    kernelIluminacao(sup->vert, sup->normal, sup->nVert, fontes, nLuzes, katt, luz);
+}
+
+// vertices do modo solido: cada triangulo tem os seus 3 vertices, com a
+// normal suave e a iluminacao do vertice e a cor do patch do triangulo.
+// Refaz os triangulos [t0, t1).
+static void MontaVerticesSolidos(malha *sup, const float *luz, float *out, int t0, int t1)
+{
+    int k, v;
+    float *o;
+    unsigned int *t;
+
+    for(k = t0; k < t1; k++)
+    {
+        t = &sup->tri[3*k];
+
+        for(v = 0; v < 3; v++)
+        {
+            o = out + (3*k + v) * 9;
+            memcpy(o, sup->vert[t[v]], 3 * sizeof(float));
+            memcpy(o + 3, sup->normal[t[v]], 3 * sizeof(float));
+            o[6] = luz[t[v]] * vcolor[sup->corTri[k]][X];
+            o[7] = luz[t[v]] * vcolor[sup->corTri[k]][Y];
+            o[8] = luz[t[v]] * vcolor[sup->corTri[k]][Z];
+        }
+    }
+}
+
+// reenvia a malha so quando ela foi reavaliada (geracao diferente). Se so
+// a transformacao do objeto mudou, refaz apenas a iluminacao (modo solido).
+static void AtualizaBuffersSuperficie(malha *sup, int geracao)
+{
+    long long t0;
+
+    if(geracao == gpu.geracaoSup && versaoModelo == gpu.versaoModelo) return;
+
+    // sem memoria ficam os buffers anteriores, que ainda sao coerentes
+    if(!Cresce(&gpu.solido, &gpu.tamSolido, 3 * (size_t)sup->nTri * 9 * sizeof(float)) ||
+       !Cresce(&gpu.luz, &gpu.tamLuz, sup->nVert * sizeof(float)))
+        return;
+    gpu.nSolido = 3 * sup->nTri;
+    gpu.nLuz = sup->nVert;
+    t0 = InicioEtapa();
+    IluminaVertices(sup, gpu.luz);
+    FimEtapa(ETAPA_ILUMINACAO, t0);
+    MontaVerticesSolidos(sup, gpu.luz, gpu.solido, 0, sup->nTri);
+    enviaBuffer(GL_ARRAY_BUFFER, gpu.bSolido, (size_t)gpu.nSolido * 9 * sizeof(float), gpu.solido);
+    gpu.versaoModelo = versaoModelo;
+
+    if(geracao == gpu.geracaoSup) return;
+
+    gpu.nVert = sup->nVert;
+    gpu.nLin = sup->nLin;
+    gpu.vert = sup->vert;
+    gpu.lin = sup->lin;
+
+    enviaBuffer(GL_ARRAY_BUFFER, gpu.bVert, (size_t)sup->nVert * sizeof(f4d), sup->vert);
+    enviaBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu.bLin, 2 * (size_t)sup->nLin * sizeof(unsigned int), sup->lin);
+
+    gpu.geracaoSup = geracao;
+}
+
+void MostrarMalha(malha *sup, int geracao)
+{
+    long long t0, ilum;
+
+    if(!sup->vert)  return;
+
+    // o envio e o MostrarMalha inteiro menos a iluminacao feita dentro dele
+    t0 = InicioEtapa();
+    ilum = nsEtapa[ETAPA_ILUMINACAO];
+    AtualizaBuffersSuperficie(sup, geracao);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    switch(tipoView)
+    {
+        case GL_POINTS:
+          glColor3f(0.0f, 0.0f, 0.7f);
+          glPointSize(1.0);
+          ligaBuffer(GL_ARRAY_BUFFER, gpu.bVert);
+          glVertexPointer(3, GL_FLOAT, sizeof(f4d), ENDERECO(gpu.vert, 0));
+          glDrawArrays(GL_POINTS, 0, gpu.nVert);
+          break;
+
+        case GL_LINE_STRIP:
+          glColor3f(0.0f, 0.0f, 0.7f);
+          ligaBuffer(GL_ARRAY_BUFFER, gpu.bVert);
+          ligaBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu.bLin);
+          glVertexPointer(3, GL_FLOAT, sizeof(f4d), ENDERECO(gpu.vert, 0));
+          glDrawElements(GL_LINES, 2 * gpu.nLin, GL_UNSIGNED_INT, ENDERECO(gpu.lin, 0));
+          break;
+
+        case GL_QUADS: // preserved for compatibility
+        case GL_TRIANGLES:
+          glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+          glEnableClientState(GL_NORMAL_ARRAY);
+          glEnableClientState(GL_COLOR_ARRAY);
+          ligaBuffer(GL_ARRAY_BUFFER, gpu.bSolido);
+          glVertexPointer(3, GL_FLOAT, 9 * sizeof(float), ENDERECO(gpu.solido, 0));
+          glNormalPointer(GL_FLOAT, 9 * sizeof(float), ENDERECO(gpu.solido, 3 * sizeof(float)));
+          glColorPointer(3, GL_FLOAT, 9 * sizeof(float), ENDERECO(gpu.solido, 6 * sizeof(float)));
+          glDrawArrays(GL_TRIANGLES, 0, gpu.nSolido);
+          glDisableClientState(GL_COLOR_ARRAY);
+          glDisableClientState(GL_NORMAL_ARRAY);
+          break;
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    ligaBuffer(GL_ARRAY_BUFFER, 0);
+    ligaBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    FimEtapa(ETAPA_ENVIO, t0 + (nsEtapa[ETAPA_ILUMINACAO] - ilum));
+}
+
+// reenvia os pontos de controle so quando pc muda (versaoPc). O buffer
+// leva as colunas fantasmas junto; elas caem sobre a coluna que repetem.
+static void AtualizaBuffersControle(matriz *sup)
+{
+    int i, j, k, passo = sup->m + sup->fantasmas;
+
+    if(gpu.versaoCtrl == versaoPc && gpu.nCtrl == sup->n * passo)
+    {
+        // so os pontos alterados por EditaPontoControle
+        if(ctrlEditIni >= 0)
+            enviaTrecho(GL_ARRAY_BUFFER, gpu.bCtrl, ctrlEditIni * sizeof(f4d),
+                        (size_t)(ctrlEditFim - ctrlEditIni) * sizeof(f4d), gpu.ctrl + ctrlEditIni);
+        ctrlEditIni = -1;
+        ctrlEditFim = 0;
+        return;
+    }
+
+    if(gpu.nCtrl != sup->n * passo)
+    {
+        // sem memoria o poligono nao e desenhado, e o proximo quadro tenta de novo
+        gpu.nCtrlLin = sup->n * (sup->m - 1) + (sup->n - 1) * sup->m;
+        if(!Cresce(&gpu.ctrlLin, &gpu.tamCtrlLin, 2 * (size_t)gpu.nCtrlLin * sizeof(unsigned int)))
+        {
+            gpu.nCtrl = gpu.nCtrlLin = 0;
+            return;
+        }
+        gpu.nCtrl = sup->n * passo;
+
+        // linhas e colunas do poligono de controle (abertas, como antes)
+        k = 0;
+        for(i=0; i<sup->n; i++)
+            for(j=0; j<sup->m - 1; j++)
+            {
+                gpu.ctrlLin[k++] = i * passo + j;
+                gpu.ctrlLin[k++] = i * passo + j + 1;
+            }
+        for(i=0; i<sup->n - 1; i++)
+            for(j=0; j<sup->m; j++)
+            {
+                gpu.ctrlLin[k++] = i * passo + j;
+                gpu.ctrlLin[k++] = (i + 1) * passo + j;
+            }
+        enviaBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu.bCtrlLin, 2 * (size_t)gpu.nCtrlLin * sizeof(unsigned int),
+                    gpu.ctrlLin);
+    }
+
+    gpu.ctrl = sup->ponto[0];   // o bloco de pontos da matriz e contiguo
+    enviaBuffer(GL_ARRAY_BUFFER, gpu.bCtrl, (size_t)gpu.nCtrl * sizeof(f4d), gpu.ctrl);
+    gpu.versaoCtrl = versaoPc;
+    ctrlEditIni = -1;
+    ctrlEditFim = 0;
+}
+
+void MostrarPtosPoligControle(matriz *sup)
+{
+    AtualizaBuffersControle(sup);
+
+    glColor3f(0.0f, 0.8f, 0.0f);
+    glPolygonMode(GL_FRONT_AND_BACK, tipoView);
+    glPointSize(7.0);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    ligaBuffer(GL_ARRAY_BUFFER, gpu.bCtrl);
+    ligaBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu.bCtrlLin);
+    glVertexPointer(3, GL_FLOAT, sizeof(f4d), ENDERECO(gpu.ctrl, 0));
+
+    glDrawArrays(GL_POINTS, 0, gpu.nCtrl);
+    glDrawElements(GL_LINES, 2 * gpu.nCtrlLin, GL_UNSIGNED_INT, ENDERECO(gpu.ctrlLin, 0));
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    ligaBuffer(GL_ARRAY_BUFFER, 0);
+    ligaBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    if(comando == EditarPonto && pontoSel[0] < sup->n && pontoSel[1] < sup->m)
+    {
+        glColor3f(1.0f, 0.0f, 0.0f);
+        glPointSize(11.0);
+        glBegin(GL_POINTS);
+        glVertex3fv(sup->ponto[pontoSel[0]][pontoSel[1]]);
+        glEnd();
+    }
+}
+
+// linhas do patch (i, j) direto em pc: as colunas fantasmas cobrem a
+// volta em j, entao o patch e uma vista da rede, sem copia nem modulo
+static inline void VistaPatch(int i, int j, f4d **linha)
+{
+    int a;
+
+    for(a = 0; a < 4; a++) linha[a] = pc->ponto[i+a] + j;
+}
+
+// pool de threads persistente: paraleloPara() distribui os indices
+// 0..total-1 entre os trabalhadores (e a thread chamadora) e so retorna
+// quando todos terminaram. Nao pode ser chamada de dentro de uma tarefa.
+typedef void (*tarefaIndice)(int k, void *arg);
+
+static struct
+{
+    std::vector<std::thread> trab;
+    std::mutex mtx;
+    std::condition_variable temTrabalho, terminou;
+    tarefaIndice tarefa;
+    void *arg;
+    int total;
+    std::atomic<int> proximo;
+    int ativos;
+    unsigned geracao;
+    bool parar;
+} pool;
+
+static void executaTarefas(void)
+{
+    int k;
+
+    while((k = pool.proximo.fetch_add(1)) < pool.total)
+        pool.tarefa(k, pool.arg);
+}
+
+static void lacoTrabalhador(void)
+{
+    unsigned vista = 0;
+
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lk(pool.mtx);
+            pool.temTrabalho.wait(lk, [&]{ return pool.parar || pool.geracao != vista; });
+            if(pool.parar) return;
+            vista = pool.geracao;
+        }
+
+        executaTarefas();
+
+        std::lock_guard<std::mutex> lk(pool.mtx);
+        if(--pool.ativos == 0) pool.terminou.notify_one();
+    }
+}
+
+int ThreadsEfetivas(void)
+{
+    int n = numThreads;
+
+    if(n <= 0) n = (int) std::thread::hardware_concurrency();
+    return n < 1 ? 1 : n;
+}
+
+static void EncerraPool(void)
+{
+    unsigned k;
+
+    {
+        std::lock_guard<std::mutex> lk(pool.mtx);
+        pool.parar = true;
+    }
+    pool.temTrabalho.notify_all();
+    for(k = 0; k < pool.trab.size(); k++) pool.trab[k].join();
+    pool.trab.clear();
+}
+
+// (re)cria os trabalhadores quando o numero de threads configurado muda
+static void AjustaPool(int n)
+{
+    unsigned k;
+    static int registrado = 0;
+
+    if((int) pool.trab.size() == n - 1) return;
+
+    if(!registrado)
+    {
+        atexit(EncerraPool);
+        registrado = 1;
+    }
+
+    EncerraPool();
+
+    pool.parar = false;
+    pool.geracao = 0;
+    for(k = 0; (int) k < n - 1; k++)
+        pool.trab.push_back(std::thread(lacoTrabalhador));
+}
+
+void paraleloPara(int total, tarefaIndice tarefa, void *arg)
+{
+    int k, n;
+
+    n = ThreadsEfetivas();
+    if(n <= 1 || total <= 1)
+    {
+        for(k = 0; k < total; k++) tarefa(k, arg);
+        return;
+    }
+
+    AjustaPool(n);
+
+    {
+        std::lock_guard<std::mutex> lk(pool.mtx);
+        pool.tarefa = tarefa;
+        pool.arg = arg;
+        pool.total = total;
+        pool.proximo = 0;
+        pool.ativos = (int) pool.trab.size();
+        pool.geracao++;
+    }
+    pool.temTrabalho.notify_all();
+
+    executaTarefas();
+
+    std::unique_lock<std::mutex> lk(pool.mtx);
+    pool.terminou.wait(lk, [&]{ return pool.ativos == 0; });
+}
+
+int CacheValido(cacheSuperficie *c)
+{
+    return c->versao == versaoPc && c->tipoBase == tipoSuperficie &&
+           c->varia == VARIA && c->modo == modoAvaliacao &&
+           c->nLinhasPatch == pc->n - 3 && c->nColunasPatch == pc->m &&
+           c->tess == modoTesselacao && (c->tess != TESS_ADAPTATIVA || c->tol == tolCorda) &&
+           (c->tess != TESS_TELA || c->pxSeg == pixelsSegmento);
+}
+
+static const tabelaPesos* tabelaDoSegmento(cacheSuperficie *c, int nSeg)
+{
+    return c->tess == TESS_UNIFORME ? &tabPesos : &tabSeg[nSeg];
+}
+
+// indice na malha do vertice (k, l) do patch (i, j)
+static unsigned int indiceVertice(cacheSuperficie *c, int i, int j, int k, int l)
+{
+    if(c->soldada)
+        return (unsigned int)((c->offS[i] + k) * c->colunasV + (c->offT[j] + l) % c->colunasV);
+    return (unsigned int)(c->basePatch[i*c->nColunasPatch + j] + k * (c->segT[j] + 1) + l);
+}
+
+// vertices que pertencem ao patch k: nS linhas de nT, a partir de base,
+// com passo entre as linhas. Na malha soldada a ultima linha e a ultima
+// coluna do patch sao do vizinho (a coluna do ultimo patch da volta e a
+// primeira do patch 0), exceto a ultima linha da ultima faixa de patches.
+static void verticesDoPatch(cacheSuperficie *c, int k, size_t *base, int *nS, int *nT, int *passo)
+{
+    int i = k / c->nColunasPatch, j = k % c->nColunasPatch;
+
+    *nS = c->segS[i] + 1;
+    *nT = c->segT[j] + 1;
+    if(c->soldada)
+    {
+        (*nT)--;
+        if(i < c->nLinhasPatch - 1) (*nS)--;
+        *base = (size_t)c->offS[i] * c->colunasV + c->offT[j];
+        *passo = c->colunasV;
+    }
+    else
+    {
+        *base = c->basePatch[k];
+        *passo = *nT;
+    }
+}
+
+// converte o patch k de pc para a forma de Bezier, em c->bezier
+static void convertePatch(int k, void *arg)
+{
+    cacheSuperficie *c = (cacheSuperficie*) arg;
+    float (*q)[4][4] = (float (*)[4][4]) (c->bezier + (size_t) k * 16);
+    f4d *linha[4];
+
+    VistaPatch(k / pc->m, k % pc->m, linha);
+    switch(tipoSuperficie)
+    {
+        case BSPLINE:    spline::paraBezierPatch<SPLINE_BSPLINE>(linha, q); break;
+        case CATMULLROM: spline::paraBezierPatch<SPLINE_CATMULLROM>(linha, q); break;
+    }
+}
+
+// pontos de Bezier de todos os patches. So sao refeitos quando a rede ou
+// a base mudam: VARIA, a tesselacao e a vista reaproveitam a conversao,
+// e a avaliacao usa sempre as tabelas de Bezier.
+static int ConvertePatches(cacheSuperficie *c)
+{
+    int n = (pc->n - 3) * pc->m;
+    long long t0;
+
+    if(c->versaoBezier == versaoPc && c->baseBezier == tipoSuperficie && c->nBezier == n)
+        return 1;
+
+    if(tipoSuperficie != BEZIER && !Cresce(&c->bezier, &c->tamBezier, (size_t) n * 16 * sizeof(f4d)))
+    {
+        c->nBezier = -1;
+        return 0;
+    }
+    c->versaoBezier = versaoPc;
+    c->baseBezier = tipoSuperficie;
+    c->nBezier = n;
+    if(tipoSuperficie == BEZIER) return 1;
+
+    t0 = InicioEtapa();
+    paraleloPara(n, convertePatch, c);
+    FimEtapa(ETAPA_CONVERSAO, t0);
+    return 1;
+}
+
+// patch k na forma de Bezier como uma matriz 4x4 sem copia: as linhas
+// apontam para c->bezier ou, na base de Bezier, direto para pc
+static void PatchBezier(cacheSuperficie *c, int k, matriz *m, f4d **linhas)
+{
+    int a;
+
+    if(c->baseBezier == BEZIER) VistaPatch(k / pc->m, k % pc->m, linhas);
+    else for(a = 0; a < 4; a++) linhas[a] = c->bezier + (size_t) k * 16 + a * 4;
+    memset(m, 0, sizeof(matriz));
+    m->n = m->m = 4;
+    m->ponto = linhas;
+}
+
+// tarefa do pool: avalia as amostras que pertencem ao patch k
+static void tesselaPatch(int k, void *arg)
+{
+    cacheSuperficie *c = (cacheSuperficie*) arg;
+    int i, j, nS, nT, passo, degeneradas;
+    size_t base;
+    long long t0;
+    matriz bez;
+    f4d *linhas[4];
+
+    i = k / c->nColunasPatch;
+    j = k % c->nColunasPatch;
+    PatchBezier(c, k, &bez, linhas);
+
+    verticesDoPatch(c, k, &base, &nS, &nT, &passo);
+
+    t0 = InicioEtapa();
+    degeneradas = ptsSuperficie(&bez, tabelaDoSegmento(c, c->segS[i]),
+                                tabelaDoSegmento(c, c->segT[j]), nS, nT,
+                                c->sup.vert + base, c->sup.normal + base, passo);
+    FimEtapa(ETAPA_AVALIACAO, t0);
+    if(degeneradas < 0) c->semMemoria = 1;
+    else if(degeneradas) c->degeneradas += degeneradas;
+}
+
+// vertices sem normal analitica (derivada nula) recebem a media das
+// normais dos triangulos vizinhos, ponderada pela area. Num polo os
+// triangulos dos dois lados podem ter normais opostas (a superficie passa
+// pelo ponto), entao cada um e somado no sentido da soma ja acumulada.
+// Aqui sao somados os triangulos [t0, t1) nos vertices com marca em deg.
+static void SomaNormaisVizinhas(malha *sup, const unsigned char *deg, int marca, int t0, int t1)
+{
+    int k, v;
+    unsigned int *t;
+    float *n, a[3], b[3], nt[3];
+
+    for(k = t0; k < t1; k++)
+    {
+        t = &sup->tri[3*k];
+        if(!(deg[t[0]] & marca) && !(deg[t[1]] & marca) && !(deg[t[2]] & marca)) continue;
+
+        for(v = 0; v < 3; v++)
+        {
+            a[v] = sup->vert[t[1]][v] - sup->vert[t[0]][v];
+            b[v] = sup->vert[t[2]][v] - sup->vert[t[0]][v];
+        }
+        nt[X] = a[Y]*b[Z] - a[Z]*b[Y];
+        nt[Y] = a[Z]*b[X] - a[X]*b[Z];
+        nt[Z] = a[X]*b[Y] - a[Y]*b[X];
+
+        for(v = 0; v < 3; v++)
+        {
+            if(!(deg[t[v]] & marca)) continue;
+            n = sup->normal[t[v]];
+            if(n[X]*nt[X] + n[Y]*nt[Y] + n[Z]*nt[Z] < 0.0f)
+            {
+                n[X] -= nt[X]; n[Y] -= nt[Y]; n[Z] -= nt[Z];
+            }
+            else
+            {
+                n[X] += nt[X]; n[Y] += nt[Y]; n[Z] += nt[Z];
+            }
+        }
+    }
+}
+
+static void normalizaNormal(float *n)
+{
+    float len = sqrtf(n[X]*n[X] + n[Y]*n[Y] + n[Z]*n[Z]);
+
+    if(len == 0.0f) len = 1.0f;
+    n[X] /= len; n[Y] /= len; n[Z] /= len;
+}
+
+static int normalNula(const float *n)
+{
+    return n[X] == 0.0f && n[Y] == 0.0f && n[Z] == 0.0f;
+}
+
+// malha inteira; deg fica com 1 nos vertices corrigidos
+static void CorrigeNormaisDegeneradas(malha *sup, unsigned char *deg)
+{
+    int v;
+
+    for(v = 0; v < sup->nVert; v++) deg[v] = normalNula(sup->normal[v]);
+
+    SomaNormaisVizinhas(sup, deg, 1, 0, sup->nTri);
+
+    for(v = 0; v < sup->nVert; v++)
+        if(deg[v]) normalizaNormal(sup->normal[v]);
+}
+
+// segmentos de cada linha/coluna de patches. Uniforme: todos com a grade
+// de VARIA. Adaptativa: escolhe os segmentos de cada patch pela tolerancia
+// de corda e usa o maximo por linha de patches (em s) e por coluna (em t).
+// LOD de tela: o mesmo, com os segmentos de SegmentosTela.
+// Patches vizinhos ficam assim com as mesmas amostras na aresta comum, sem
+// vertices em T nem rachaduras, mesmo com densidades diferentes.
+// Devolve 0 se faltar memoria para as tabelas.
+static int EscolheSegmentos(cacheSuperficie *c, int *segS, int *segT)
+{
+    int i, j, ns, nt, nn, maxSeg;
+    matriz bez;
+    f4d *linhas[4];
+
+    nn = pc->n - 3;
+    maxSeg = tabPesos.n - 1;   // nunca mais denso que a grade uniforme
+    if(maxSeg < 1) maxSeg = 1;
+
+    if(c->tess == TESS_UNIFORME)
+    {
+        for(i = 0; i < nn; i++) segS[i] = maxSeg;
+        for(j = 0; j < pc->m; j++) segT[j] = maxSeg;
+        return 1;
+    }
+
+    for(i = 0; i < nn; i++) segS[i] = 1;
+    for(j = 0; j < pc->m; j++) segT[j] = 1;
+
+    for(i = 0; i < nn; i++)
+    {
+        for(j = 0; j < pc->m; j++)
+        {
+            PatchBezier(c, i * pc->m + j, &bez, linhas);
+            if(c->tess == TESS_TELA) ns = nt = SegmentosTela(&bez, maxSeg);
+            else SegmentosPatch(&bez, tolCorda, maxSeg, &ns, &nt);
+            if(ns > segS[i]) segS[i] = ns;
+            if(nt > segT[j]) segT[j] = nt;
+        }
+    }
+
+    // as tabelas sao criadas aqui, antes das threads
+    for(i = 0; i < nn; i++)
+        if(!TabelaSegmentos(segS[i])) return 0;
+    for(j = 0; j < pc->m; j++)
+        if(!TabelaSegmentos(segT[j])) return 0;
+    return 1;
+}
+
+// (re)monta vertices e indices quando a quantidade de patches, os
+// segmentos ou a soldagem mudam; depois disso so os vertices mudam.
+// Devolve 0 se faltar memoria.
+static int MontaTopologia(cacheSuperficie *c)
+{
+    int i, j, k, l, p, nn, mm, nVert, maxTri, maxLin, ultimaLinha;
+    unsigned int v00, v01, v10, v11;
+    malha *sup = &c->sup;
+
+    nn = c->nLinhasPatch;
+    mm = c->nColunasPatch;
+
+    if(!Cresce(&c->offS, &c->tamOffS, (nn + 1) * sizeof(int)) ||
+       !Cresce(&c->offT, &c->tamOffT, (mm + 1) * sizeof(int)) ||
+       !Cresce(&c->basePatch, &c->tamBasePatch, (nn * mm + 1) * sizeof(int)) ||
+       !Cresce(&c->baseTri, &c->tamBaseTri, (nn * mm + 1) * sizeof(int)) ||
+       !Cresce(&c->sujo, &c->tamSujo, nn * mm) ||
+       !Cresce(&c->marca, &c->tamMarca, nn * mm))
+        return 0;
+    memset(c->sujo, 0, nn * mm);
+    memset(c->marca, 0, nn * mm);
+    c->nSujos = 0;
+
+    c->offS[0] = 0;
+    for(i = 0; i < nn; i++) c->offS[i+1] = c->offS[i] + c->segS[i];
+    c->offT[0] = 0;
+    for(j = 0; j < mm; j++) c->offT[j+1] = c->offT[j] + c->segT[j];
+    c->colunasV = c->offT[mm];
+
+    maxTri = maxLin = 0;
+    c->basePatch[0] = 0;
+    for(p = 0; p < nn * mm; p++)
+    {
+        i = p / mm;
+        j = p % mm;
+        c->basePatch[p+1] = c->basePatch[p] + (c->segS[i] + 1) * (c->segT[j] + 1);
+        maxTri += 2 * c->segS[i] * c->segT[j];
+        maxLin += (c->segS[i] + 1) * c->segT[j] + c->segS[i] * (c->segT[j] + 1);
+    }
+
+    nVert = c->soldada ? (c->offS[nn] + 1) * c->colunasV : c->basePatch[nn * mm];
+
+    // vetores de um .stb mapeado nao sao do heap; os do heap so crescem
+    // (uma malha menor reaproveita os da maior)
+    if(sup->mapeada)
+    {
+        sup->vert = sup->normal = NULL;
+        sup->tri = sup->lin = NULL;
+        sup->corTri = NULL;
+        sup->mapeada = 0;
+    }
+    if(!Cresce(&sup->vert, &sup->tamVert, (size_t) nVert * sizeof(f4d)) ||
+       !Cresce(&sup->normal, &sup->tamNormal, (size_t) nVert * sizeof(f4d)) ||
+       !Cresce(&sup->tri, &sup->tamTri, 3 * (size_t)maxTri * sizeof(unsigned int)) ||
+       !Cresce(&sup->corTri, &sup->tamCorTri, maxTri) ||
+       !Cresce(&sup->lin, &sup->tamLin, 2 * (size_t)maxLin * sizeof(unsigned int)) ||
+       !Cresce(&c->degVert, &c->tamDegVert, nVert))
+        return 0;
+    memset(sup->vert, 0, (size_t) nVert * sizeof(f4d));     // o kernel nao escreve w
+    memset(sup->normal, 0, (size_t) nVert * sizeof(f4d));
+    sup->nVert = nVert;
+    sup->nTri = sup->nLin = 0;
+
+    for(i = 0; i < nn; i++)
+    {
+        for(j = 0; j < mm; j++)
+        {
+            c->baseTri[i*mm + j] = sup->nTri;
+            for(k = 0; k < c->segS[i]; k++)
+            {
+                for(l = 0; l < c->segT[j]; l++)
+                {
+                    v00 = indiceVertice(c, i, j, k, l);
+                    v01 = indiceVertice(c, i, j, k, l+1);
+                    v10 = indiceVertice(c, i, j, k+1, l);
+                    v11 = indiceVertice(c, i, j, k+1, l+1);
+
+                    // Triângulo 1: v00, v01, v11 / Triângulo 2: v00, v11, v10
+                    sup->tri[3*sup->nTri] = v00;
+                    sup->tri[3*sup->nTri+1] = v01;
+                    sup->tri[3*sup->nTri+2] = v11;
+                    sup->corTri[sup->nTri++] = (i+j)%4;
+
+                    sup->tri[3*sup->nTri] = v00;
+                    sup->tri[3*sup->nTri+1] = v11;
+                    sup->tri[3*sup->nTri+2] = v10;
+                    sup->corTri[sup->nTri++] = (i+j)%4;
+                }
+            }
+
+            // arestas da malha: na soldada cada aresta de costura sai uma
+            // vez so (a do patch que e dono daquela linha/coluna)
+            ultimaLinha = !c->soldada || i == nn - 1;
+            for(k = 0; k <= c->segS[i] - !ultimaLinha; k++)
+                for(l = 0; l < c->segT[j]; l++)
+                {
+                    sup->lin[2*sup->nLin] = indiceVertice(c, i, j, k, l);
+                    sup->lin[2*sup->nLin+1] = indiceVertice(c, i, j, k, l+1);
+                    sup->nLin++;
+                }
+            for(k = 0; k < c->segS[i]; k++)
+                for(l = 0; l <= c->segT[j] - c->soldada; l++)
+                {
+                    sup->lin[2*sup->nLin] = indiceVertice(c, i, j, k, l);
+                    sup->lin[2*sup->nLin+1] = indiceVertice(c, i, j, k+1, l);
+                    sup->nLin++;
+                }
+        }
+    }
+    c->baseTri[nn * mm] = sup->nTri;
+    return 1;
+}
+
+// sem memoria para a malha nova: o cache fica vazio e invalido, e a
+// proxima reavaliacao monta tudo de novo
+static void EsvaziaCache(cacheSuperficie *c)
+{
+    c->nLinhasPatch = c->nColunasPatch = c->nPatches = 0;
+    c->nSujos = 0;
+    c->parcial = 0;
+    c->sup.nVert = c->sup.nTri = c->sup.nLin = 0;
+    c->geracao++;
+}
+
+// reavalia todos os patches para o cache; so e chamada quando pc, a base
+// ou a resolucao mudam. Com numThreads != 1 os patches sao distribuidos
+// entre as threads do pool, cada um escrevendo na sua parte da malha.
+void AtualizaCache(cacheSuperficie *c)
+{
+    int nn, mm, soldada, mudou, k;
+    int *segS, *segT;
+    size_t marca = arenaQuadro.usado;
+    long long t0;
+
+    nn = pc->n - 3;   // numero de descolamentos (patchs)
+    mm = pc->m;
+
+    // prepara o estado compartilhado antes de disparar as threads
+    if(!kernelLinhaSup) EscolheKernelSuperficie(KERNEL_AVX2);
+    if(!AtualizaTabelaPesos(&tabPesos) || !ConvertePatches(c)) return;
+
+    c->tess = modoTesselacao;
+    c->tol = tolCorda;
+    c->pxSeg = pixelsSegmento;
+    c->vistaModelo = versaoModelo;
+    c->vistaEscala = pixelsPorUnidade;
+
+    // segmentos candidatos no rascunho do quadro; so sao copiados para o
+    // cache se mudarem
+    segS = (int*) ArenaAloca(&arenaQuadro, nn * sizeof(int));
+    segT = (int*) ArenaAloca(&arenaQuadro, mm * sizeof(int));
+    if(!segS || !segT || !EscolheSegmentos(c, segS, segT))
+    {
+        ArenaLibera(&arenaQuadro, marca);
+        EsvaziaCache(c);
+        return;
+    }
+
+    // Bezier com deslocamento de um ponto nao forma superficie continua,
+    // entao so as outras bases compartilham os vertices das costuras
+    soldada = tipoSuperficie != BEZIER;
+
+    mudou = !c->segS || c->nLinhasPatch != nn || c->nColunasPatch != mm ||
+            c->soldada != soldada ||
+            memcmp(segS, c->segS, nn * sizeof(int)) || memcmp(segT, c->segT, mm * sizeof(int));
+
+    if(mudou)
+    {
+        if(!Cresce(&c->segS, &c->tamSegS, nn * sizeof(int)) ||
+           !Cresce(&c->segT, &c->tamSegT, mm * sizeof(int)))
+        {
+            ArenaLibera(&arenaQuadro, marca);
+            EsvaziaCache(c);
+            return;
+        }
+        memcpy(c->segS, segS, nn * sizeof(int));
+        memcpy(c->segT, segT, mm * sizeof(int));
+    }
+    ArenaLibera(&arenaQuadro, marca);
+    c->nLinhasPatch = nn;
+    c->nColunasPatch = mm;
+    c->nPatches = nn * mm;
+    c->soldada = soldada;
+
+    if(mudou && !MontaTopologia(c))
+    {
+        EsvaziaCache(c);
+        return;
+    }
+
+    c->degeneradas = 0;
+    c->semMemoria = 0;
+    paraleloPara(c->nPatches, tesselaPatch, c);
+    if(c->semMemoria)
+    {
+        EsvaziaCache(c);
+        return;
+    }
+    if(c->degeneradas)
+    {
+        t0 = InicioEtapa();
+        CorrigeNormaisDegeneradas(&c->sup, c->degVert);
+        FimEtapa(ETAPA_ILUMINACAO, t0);
+    }
+    else memset(c->degVert, 0, c->sup.nVert);
+
+    // a reavaliacao inteira ja inclui as edicoes pendentes
+    for(k = 0; k < c->nSujos; k++) c->sujo[c->listaSujos[k]] = 0;
+    c->nSujos = 0;
+    c->parcial = 0;
+
+    c->tipoBase = tipoSuperficie;
+    c->varia = VARIA;
+    c->versao = versaoPc;
+    c->modo = modoAvaliacao;
+    c->geracao++;
+
+    GravaCachePendente(c);
+}
+
+// ---- edicao de pontos de controle ----
+// Um ponto (i, j) de pc entra nos patches das linhas i-3..i e das colunas
+// j-3..j (com a volta das colunas), e so esses sao reavaliados (conjunto
+// D). Na malha soldada os vertices de D tambem aparecem nos triangulos
+// dos patches de cima e da esquerda. Por isso as normais degeneradas sao
+// refeitas nos patches a ate 1 de D (conjunto B), somando os triangulos
+// dos patches de -2 a +1 (conjunto C), e o resultado e o mesmo de uma
+// reavaliacao inteira. O custo por edicao nao depende do tamanho da rede.
+
+static int comparaInt(const void *a, const void *b)
+{
+    return *(const int*) a - *(const int*) b;
+}
+
+// patches de D deslocados de d0 a d1 em linha e coluna, sem repetir e em
+// ordem crescente (a soma das normais segue a ordem dos triangulos)
+static int VizinhancaSujos(cacheSuperficie *c, int d0, int d1, int *lista)
+{
+    int q, k, i, j, di, dj, ii, p, n = 0;
+    int nn = c->nLinhasPatch, mm = c->nColunasPatch;
+
+    for(q = 0; q < c->nSujos; q++)
+    {
+        k = c->listaSujos[q];
+        i = k / mm;
+        j = k % mm;
+        for(di = d0; di <= d1; di++)
+        {
+            ii = i + di;
+            if(ii < 0 || ii >= nn) continue;
+            for(dj = d0; dj <= d1; dj++)
+            {
+                p = ii * mm + ((j + dj) % mm + mm) % mm;
+                if(c->marca[p]) continue;
+                c->marca[p] = 1;
+                lista[n++] = p;
+            }
+        }
+    }
+    for(q = 0; q < n; q++) c->marca[lista[q]] = 0;
+    qsort(lista, n, sizeof(int), comparaInt);
+    return n;
+}
+
+static void tesselaPatchSujo(int q, void *arg)
+{
+    cacheSuperficie *c = (cacheSuperficie*) arg;
+
+    convertePatch(c->listaSujos[q], c);
+    tesselaPatch(c->listaSujos[q], c);
+}
+
+// reavalia so os patches marcados por EditaPontoControle e deixa em listaB
+// e listaC o que o envio ao OpenGL precisa refazer
+void AtualizaPatchesSujos(cacheSuperficie *c)
+{
+    int q, r, l, k, temDeg = 0, nS, nT, passo;
+    size_t base, v;
+    long long t0;
+
+    // listas anteriores que nao chegaram ao OpenGL: o proximo envio e inteiro
+    if(c->parcial) c->geracao++;
+
+    // sem memoria para as listas a reavaliacao e inteira
+    if(!Cresce(&c->listaB, &c->tamListaB, (size_t) c->nSujos * 9 * sizeof(int)) ||
+       !Cresce(&c->listaC, &c->tamListaC, (size_t) c->nSujos * 16 * sizeof(int)))
+    {
+        versaoPc++;
+        return;
+    }
+
+    c->degeneradas = 0;
+    c->semMemoria = 0;
+    paraleloPara(c->nSujos, tesselaPatchSujo, c);
+    if(c->semMemoria)
+    {
+        versaoPc++;
+        return;
+    }
+
+    t0 = InicioEtapa();
+    c->nB = VizinhancaSujos(c, -1, 1, c->listaB);
+    c->nC = VizinhancaSujos(c, -2, 1, c->listaC);
+
+    // degeneradas de B: as de D sao as da nova avaliacao, as outras as ja
+    // conhecidas; todas sao zeradas e refeitas (marca 2)
+    for(q = 0; q < c->nB; q++)
+    {
+        k = c->listaB[q];
+        verticesDoPatch(c, k, &base, &nS, &nT, &passo);
+        for(r = 0; r < nS; r++)
+            for(l = 0; l < nT; l++)
+            {
+                v = base + (size_t) r * passo + l;
+                if(c->sujo[k]) c->degVert[v] = normalNula(c->sup.normal[v]);
+                if(!c->degVert[v]) continue;
+                c->sup.normal[v][X] = c->sup.normal[v][Y] = c->sup.normal[v][Z] = 0.0f;
+                c->degVert[v] |= 2;
+                temDeg = 1;
+            }
+    }
+
+    if(temDeg)
+    {
+        for(q = 0; q < c->nC; q++)
+            SomaNormaisVizinhas(&c->sup, c->degVert, 2, c->baseTri[c->listaC[q]], c->baseTri[c->listaC[q] + 1]);
+
+        for(q = 0; q < c->nB; q++)
+        {
+            verticesDoPatch(c, c->listaB[q], &base, &nS, &nT, &passo);
+            for(r = 0; r < nS; r++)
+                for(l = 0; l < nT; l++)
+                {
+                    v = base + (size_t) r * passo + l;
+                    if(!(c->degVert[v] & 2)) continue;
+                    normalizaNormal(c->sup.normal[v]);
+                    c->degVert[v] = 1;
+                }
+        }
+    }
+    FimEtapa(ETAPA_ILUMINACAO, t0);
+
+    for(q = 0; q < c->nSujos; q++) c->sujo[c->listaSujos[q]] = 0;
+    c->nSujos = 0;
+    c->parcial = 1;
+}
+
+// envia ao OpenGL so o que AtualizaPatchesSujos refez: posicoes dos
+// vertices de B, iluminacao deles e os vertices solidos dos triangulos
+// de C. Com buffers de outra geracao ou de outra transformacao do objeto,
+// MostrarMalha refaz tudo.
+static void ReenviaPatches(cacheSuperficie *c)
+{
+    fonteLuz fontes[MAX_LUZES];
+    float katt;
+    int q, r, p, nS, nT, passo;
+    size_t base, lin;
+    long long t0;
+    malha *sup = &c->sup;
+
+    c->parcial = 0;
+    if(gpu.geracaoSup != c->geracao) return;
+
+    t0 = InicioEtapa();
+    for(q = 0; q < c->nB; q++)
+    {
+        verticesDoPatch(c, c->listaB[q], &base, &nS, &nT, &passo);
+        for(r = 0; r < nS; r++)
+        {
+            lin = base + (size_t) r * passo;
+            enviaTrecho(GL_ARRAY_BUFFER, gpu.bVert, lin * sizeof(f4d), nT * sizeof(f4d), sup->vert + lin);
+        }
+    }
+    FimEtapa(ETAPA_ENVIO, t0);
+
+    if(gpu.versaoModelo != versaoModelo) return;
+
+    t0 = InicioEtapa();
+    LuzesNoObjeto(fontes, &katt);
+    for(q = 0; q < c->nB; q++)
+    {
+        verticesDoPatch(c, c->listaB[q], &base, &nS, &nT, &passo);
+        for(r = 0; r < nS; r++)
+        {
+            lin = base + (size_t) r * passo;
+            kernelIluminacao(sup->vert + lin, sup->normal + lin, nT, fontes, nLuzes, katt, gpu.luz + lin);
+        }
+    }
+    FimEtapa(ETAPA_ILUMINACAO, t0);
+
+    t0 = InicioEtapa();
+    for(q = 0; q < c->nC; q++)
+    {
+        p = c->listaC[q];
+        MontaVerticesSolidos(sup, gpu.luz, gpu.solido, c->baseTri[p], c->baseTri[p+1]);
+        enviaTrecho(GL_ARRAY_BUFFER, gpu.bSolido, (size_t) c->baseTri[p] * 27 * sizeof(float),
+                    (size_t)(c->baseTri[p+1] - c->baseTri[p]) * 27 * sizeof(float),
+                    gpu.solido + (size_t) c->baseTri[p] * 27);
+    }
+    FimEtapa(ETAPA_ENVIO, t0);
+}
+
+// LOD de tela: com outra vista (transformacao do objeto ou janela) os
+// segmentos sao escolhidos de novo, e a malha so e reavaliada se mudarem
+static int VistaMudouLOD(cacheSuperficie *c)
+{
+    int *segS, *segT, mudou;
+    int nn = c->nLinhasPatch, mm = c->nColunasPatch;
+    size_t marca = arenaQuadro.usado;
+
+    if(c->tess != TESS_TELA || !c->segS) return 0;
+    if(c->vistaModelo == versaoModelo && c->vistaEscala == pixelsPorUnidade) return 0;
+
+    segS = (int*) ArenaAloca(&arenaQuadro, nn * sizeof(int));
+    segT = (int*) ArenaAloca(&arenaQuadro, mm * sizeof(int));
+    // sem as tabelas, AtualizaCache tenta de novo (e esvazia o cache)
+    mudou = !segS || !segT || !EscolheSegmentos(c, segS, segT) ||
+            memcmp(segS, c->segS, nn * sizeof(int)) || memcmp(segT, c->segT, mm * sizeof(int));
+    ArenaLibera(&arenaQuadro, marca);
+
+    c->vistaModelo = versaoModelo;
+    c->vistaEscala = pixelsPorUnidade;
+    return mudou;
+}
+
+void DisenaSuperficie(void)
+{
+    if(pc->n - 3 <= 0) return;   // nenhum patch
+
+    if(!CacheValido(&cacheSup) || VistaMudouLOD(&cacheSup)) AtualizaCache(&cacheSup);
+    else if(cacheSup.nSujos) AtualizaPatchesSujos(&cacheSup);
+    if(cacheSup.parcial) ReenviaPatches(&cacheSup);
+
+    MostrarMalha(&cacheSup.sup, cacheSup.geracao);
+}
+
+
+static void init(void)
+{
+
+   glClearColor(1.0, 1.0, 1.0, 0.0);
+   glEnable(GL_DEPTH_TEST);
+   // Mantemos shading manual (calculado por triângulo), então não habilitamos GL_LIGHTING automático.
+   glEnable(GL_MAP2_VERTEX_3);
+   glEnable(GL_AUTO_NORMAL);
+   glMapGrid2f(20, 0.0, 1.0, 20, 0.0, 1.0);
+
+   IniciaBuffersGL();
+}
+
+void display(void)
+{
+   long long tQuadro, t0;
+
+   ZeraQuadroPerfil();
+   tQuadro = InicioEtapa();
+
+   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+   glPushMatrix();
+
+   if(pc)
    {
+       glPushMatrix();
+       AplicaModelo();
+       t0 = InicioEtapa();
        MostrarPtosPoligControle(pc);
+       FimEtapa(ETAPA_CONTROLE, t0);
        DisenaSuperficie();    // disenhando un objeto
+       glPopMatrix();
+   }
+
+   // Desenhar indicadores das luzes (pequenas esferas coloridas)
+   for(int k = 0; k < nLuzes; k++)
+   {
+       glPushMatrix();
+         glTranslatef(luzes[k].pos[X], luzes[k].pos[Y], luzes[k].pos[Z]);
+         glColor3fv(luzes[k].cor);
+         glutSolidSphere(k == 0 ? 0.3f : 0.25f, 10, 10);
+       glPopMatrix();
+   }
+
+   glPopMatrix();
+
+   FimEtapa(ETAPA_QUADRO, tQuadro);
+   ArenaLibera(&arenaQuadro, 0);   // fim do rascunho do quadro
+   FechaQuadroPerfil();
+   if(perfilOverlay) MostrarOverlayPerfil();
+
+   glutSwapBuffers();
+}
+
+
+// volume do glOrtho para uma janela w x h: 20 unidades no lado menor.
+// j = esquerda, direita, baixo, cima, perto, longe (tambem usado por
+// RasterizaMalha)
+void JanelaOrtho(int w, int h, double j[6])
+{
+   if (w <= h)
+   {
+      j[0] = -10.0;  j[1] = 10.0;
+      j[2] = -10.0*(GLfloat)h/(GLfloat)w;  j[3] = 10.0*(GLfloat)h/(GLfloat)w;
+   }
+   else
+   {
+      j[0] = -10.0*(GLfloat)w/(GLfloat)h;  j[1] = 10.0*(GLfloat)w/(GLfloat)h;
+      j[2] = -10.0;  j[3] = 10.0;
+   }
+   j[4] = -10.0;  j[5] = 30.0;
+}
+
+void reshape(int w, int h)
+{
+   double j[6];
+
+   glViewport(0, 0, (GLsizei) w, (GLsizei) h);
+   pixelsPorUnidade = (w <= h ? w : h) / 20.0f;
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   JanelaOrtho(w, h, j);
+   glOrtho(j[0], j[1], j[2], j[3], j[4], j[5]);
+   glMatrixMode(GL_MODELVIEW);
+}
+
+// modo Editar ponto: esquerda/direita escolhem a coluna, PageUp/PageDown
+// a linha, e cima/baixo afastam/aproximam o ponto do eixo z (5%)
+static void EditaPontoTeclado(int key)
+{
+    f4d p;
+    float f = 1.0f;
+
+    if(!pc) return;
+    if(pontoSel[0] >= pc->n) pontoSel[0] = pc->n - 1;
+    if(pontoSel[1] >= pc->m) pontoSel[1] = pc->m - 1;
+
+    switch(key)
+    {
+        case GLUT_KEY_LEFT:      pontoSel[1] = (pontoSel[1] + pc->m - 1) % pc->m; break;
+        case GLUT_KEY_RIGHT:     pontoSel[1] = (pontoSel[1] + 1) % pc->m; break;
+        case GLUT_KEY_PAGE_UP:   if(pontoSel[0] > 0) pontoSel[0]--; break;
+        case GLUT_KEY_PAGE_DOWN: if(pontoSel[0] < pc->n - 1) pontoSel[0]++; break;
+        case GLUT_KEY_UP:        f = 1.05f; break;
+        case GLUT_KEY_DOWN:      f = 0.95f; break;
+    }
+
+    if(f == 1.0f) return;
+    memcpy(p, pc->ponto[pontoSel[0]][pontoSel[1]], sizeof(f4d));
+    p[X] *= f;
+    p[Y] *= f;
+    EditaPontoControle(pontoSel[0], pontoSel[1], p);
+}
+
+void keyboard(int key, int x, int y)
+{
+    int i,j;
+
+    if(comando == EditarPonto)
+    {
+        EditaPontoTeclado(key);
+        glutPostRedisplay();
+        return;
+    }
+
+    MatrizIdentidade();
+    switch(comando)
+    {   case Redimensionar:
+            switch (key)
+            {   case GLUT_KEY_LEFT:
+                    AuxVertex[0][0] = 0.95;
+                    AuxVertex[1][1] = 0.95;
+                    AuxVertex[2][2] = 0.95;
+                    break;
+                case GLUT_KEY_RIGHT:
+                    AuxVertex[0][0] = 1.05;
+                    AuxVertex[1][1] = 1.05;
+                    AuxVertex[2][2] = 1.05;
+                    break;
+                case GLUT_KEY_UP:
+                    AuxVertex[0][0] = 1.05;
+                    AuxVertex[1][1] = 1.05;
+                    AuxVertex[2][2] = 1.05;
+                    break;
+                case GLUT_KEY_DOWN:
+                    AuxVertex[0][0] = 0.95;
+                    AuxVertex[1][1] = 0.95;
+                    AuxVertex[2][2] = 0.95;
+                    break;
+            }
+            break;
+
+        case GirarX:
+            switch (key)
+            {   case GLUT_KEY_LEFT:
+                    AuxVertex[1][1] = cos(-0.01);
+                    AuxVertex[1][2] = sin(-0.01);
+                    AuxVertex[2][1] = -sin(-0.01);
+                    AuxVertex[2][2] = cos(-0.01);
+                    break;
+                case GLUT_KEY_RIGHT:
+                    AuxVertex[1][1] = cos(0.01);
+                    AuxVertex[1][2] = sin(0.01);
+                    AuxVertex[2][1] = -sin(0.01);
+                    AuxVertex[2][2] = cos(0.01);
+                    break;
+                case GLUT_KEY_UP:
+                    AuxVertex[1][1] = cos(0.01);
+                    AuxVertex[1][2] = sin(0.01);
+                    AuxVertex[2][1] = -sin(0.01);
+                    AuxVertex[2][2] = cos(0.01);
+                    break;
+                case GLUT_KEY_DOWN:
+                    AuxVertex[1][1] = cos(-0.01);
+                    AuxVertex[1][2] = sin(-0.01);
+                    AuxVertex[2][1] = -sin(-0.01);
+                    AuxVertex[2][2] = cos(-0.01);
+                    break;
+            }
+            break;
+        case GirarY:
+            switch (key)
+            {   case GLUT_KEY_LEFT:
+                    AuxVertex[0][0] = cos(-0.01);
+                    AuxVertex[0][2] = -sin(-0.01);
+                    AuxVertex[2][0] = sin(-0.01);
+                    AuxVertex[2][2] = cos(-0.01);
+                    break;
+                case GLUT_KEY_RIGHT:
+                    AuxVertex[0][0] = cos(0.01);
+                    AuxVertex[0][2] = -sin(0.01);
+                    AuxVertex[2][0] = sin(0.01);
+                    AuxVertex[2][2] = cos(0.01);
+                    break;
+                case GLUT_KEY_UP:
+                    AuxVertex[0][0] = cos(0.01);
+                    AuxVertex[0][2] = -sin(0.01);
+                    AuxVertex[2][0] = sin(0.01);
+                    AuxVertex[2][2] = cos(0.01);
+                    break;
+                case GLUT_KEY_DOWN:
+                    AuxVertex[0][0] = cos(-0.01);
+                    AuxVertex[0][2] = -sin(-0.01);
+                    AuxVertex[2][0] = sin(-0.01);
+                    AuxVertex[2][2] = cos(-0.01);
+                    break;
+            }
+            break;
+        case GirarZ:
+            switch (key)
+            {   case GLUT_KEY_LEFT:
+                    AuxVertex[0][0] = cos(-0.01);
+                    AuxVertex[0][1] = sin(-0.01);
+                    AuxVertex[1][0] = -sin(-0.01);
+                    AuxVertex[1][1] = cos(-0.01);
+                    break;
+                case GLUT_KEY_RIGHT:
+                    AuxVertex[0][0] = cos(0.01);
+                    AuxVertex[0][1] = sin(0.01);
+                    AuxVertex[1][0] = -sin(0.01);
+                    AuxVertex[1][1] = cos(0.01);
+                    break;
+                case GLUT_KEY_UP:
+                    AuxVertex[0][0] = cos(0.01);
+                    AuxVertex[0][1] = sin(0.01);
+                    AuxVertex[1][0] = -sin(0.01);
+                    AuxVertex[1][1] = cos(0.01);
+                    break;
+                case GLUT_KEY_DOWN:
+                    AuxVertex[0][0] = cos(-0.01);
+                    AuxVertex[0][1] = sin(-0.01);
+                    AuxVertex[1][0] = -sin(-0.01);
+                    AuxVertex[1][1] = cos(-0.01);
+                    break;
+            }
+            break;
+
    }
+    MultMatriz();
+    glutPostRedisplay();
+}
+
+// ---- leitura dos pontos de controle ----
+// O arquivo inteiro e mapeado em memoria (lido de uma vez no Windows) e
+// analisado no lugar, sem alocar nada por token. Formato:
+//   #superficie
+//   #vertices n m
+//   <rotulo> x y z        (n*m linhas, linha j do patch varia mais devagar)
+
+typedef struct st_arquivoMapeado
+{
+    const char *dados;
+    size_t tam;
+    int mapeado;
+} arquivoMapeado;
+
+static int MapeiaArquivo(const char *arq, arquivoMapeado *a)
+{
+    a->dados = "";
+    a->tam = 0;
+    a->mapeado = 0;
+
+#ifndef _WIN32
+    int fd;
+    struct stat st;
+    void *p;
+
+    if((fd = open(arq, O_RDONLY)) < 0) return 0;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+    if(st.st_size > 0)
+    {
+#ifdef MAP_POPULATE
+        // le as paginas de uma vez em vez de uma falta de pagina por vez
+        p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+        p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+        if(p == MAP_FAILED)
+        {
+            close(fd);
+            return 0;
+        }
+        madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+        a->dados = (const char*) p;
+        a->tam = (size_t) st.st_size;
+        a->mapeado = 1;
+    }
+    close(fd);
+    return 1;
+#else
+    FILE *f;
+    long tam;
+    char *buf;
+
+    if((f = fopen(arq, "rb")) == NULL) return 0;
+    fseek(f, 0, SEEK_END);
+    tam = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(tam > 0)
+    {
+        buf = (char*) malloc(tam);
+        if(!buf || fread(buf, 1, tam, f) != (size_t) tam)
+        {
+            free(buf);
+            fclose(f);
+            return 0;
+        }
+        a->dados = buf;
+        a->tam = (size_t) tam;
+    }
+    fclose(f);
+    return 1;
+#endif
+}
+
+static void DesmapeiaArquivo(arquivoMapeado *a)
+{
+    if(a->tam == 0) return;
+#ifndef _WIN32
+    if(a->mapeado) munmap((void*) a->dados, a->tam);
+#else
+    free((void*) a->dados);
+#endif
+    a->tam = 0;
+}
+
+typedef struct st_leitor
+{
+    const char *p, *fim;
+    const char *inicioLinha;
+    int linha;
+    const char *arq;
+} leitor;
+
+static void erroLeitura(const leitor *l, const char *msg)
+{
+    printf("%s:%d:%d: %s\n", l->arq, l->linha, (int)(l->p - l->inicioLinha) + 1, msg);
+}
+
+// brancos: espaco e caracteres de controle; uma comparacao so por byte
+#define EH_BRANCO(c) ((unsigned char)(c) <= ' ')
+#define EH_DIGITO(c) ((unsigned)((c) - '0') <= 9u)
+
+// pula brancos contando as linhas; devolve 0 no fim do arquivo
+static int pulaBrancos(leitor *l)
+{
+    while(l->p < l->fim && EH_BRANCO(*l->p))
+    {
+        if(*l->p == '\n')
+        {
+            l->linha++;
+            l->inicioLinha = l->p + 1;
+        }
+        l->p++;
+    }
+    return l->p < l->fim;
+}
+
+static void pulaLinha(leitor *l)
+{
+    while(l->p < l->fim && *l->p != '\n') l->p++;
+}
+
+// pula um token qualquer (rotulo como "#vertices" ou "#v12")
+static int pulaToken(leitor *l)
+{
+    if(!pulaBrancos(l)) return 0;
+    while(l->p < l->fim && !EH_BRANCO(*l->p)) l->p++;
+    return 1;
+}
+
+static int leInteiro(leitor *l, int *v)
+{
+    long long x = 0;
+    const char *q;
+
+    if(!pulaBrancos(l) || !EH_DIGITO(*l->p)) return 0;
+    for(q = l->p; q < l->fim && EH_DIGITO(*q); q++)
+    {
+        x = x * 10 + (*q - '0');
+        if(x > 0x7fffffff) return 0;
+    }
+    if(q < l->fim && !EH_BRANCO(*q)) return 0;
+
+    l->p = q;
+    *v = (int) x;
+    return 1;
+}
+
+// [+-]digitos[.digitos][(e|E)[+-]digitos]. Ate 15 digitos significativos
+// e expoente em [-22, 22] o valor sai de uma operacao exata em double;
+// fora disso usa strtod numa copia do token.
+static int leFloat(leitor *l, float *v)
+{
+    static const double pot10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                   1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                   1e20, 1e21, 1e22};
+    const char *q, *fim = l->fim;
+    unsigned long long mant = 0;
+    int digitos = 0, exp10 = 0, e = 0, negE = 0, neg = 0, algum = 0;
+    double d;
+    char copia[64];
+
+    if(!pulaBrancos(l)) return 0;
+    q = l->p;
+
+    if(*q == '-' || *q == '+') neg = *q++ == '-';
+
+    // zeros a esquerda nao contam como digitos significativos
+    for(; q < fim && *q == '0'; q++) algum = 1;
+    for(; q < fim && EH_DIGITO(*q); q++, algum = 1)
+    {
+        if(digitos < 19)
+        {
+            mant = mant * 10 + (*q - '0');
+            digitos++;
+        }
+        else exp10++;
+    }
+    if(q < fim && *q == '.')
+    {
+        for(q++; q < fim && EH_DIGITO(*q); q++, algum = 1)
+        {
+            if(digitos < 19)
+            {
+                mant = mant * 10 + (*q - '0');
+                if(mant) digitos++;
+                exp10--;
+            }
+        }
+    }
+    if(!algum) return 0;
+
+    if(q < fim && (*q == 'e' || *q == 'E'))
+    {
+        q++;
+        if(q < fim && (*q == '-' || *q == '+')) negE = *q++ == '-';
+        if(q >= fim || !EH_DIGITO(*q)) return 0;
+        for(; q < fim && EH_DIGITO(*q); q++)
+            if(e < 10000) e = e * 10 + (*q - '0');
+        exp10 += negE ? -e : e;
+    }
+    if(q < fim && !EH_BRANCO(*q)) return 0;
+
+    if(digitos <= 15 && exp10 >= -22 && exp10 <= 22)
+    {
+        d = (double) mant;
+        d = exp10 < 0 ? d / pot10[-exp10] : d * pot10[exp10];
+        if(neg) d = -d;
+    }
+    else
+    {
+        if(q - l->p >= (long) sizeof(copia)) return 0;
+        memcpy(copia, l->p, q - l->p);
+        copia[q - l->p] = '\0';
+        d = strtod(copia, NULL);
+    }
+
+    if(!(fabs(d) <= 3.4028234663852886e38)) return 0;   // fora do float (ou NaN)
+
+    *v = (float) d;
+    l->p = q;
+    return 1;
+}
+
+// "#superficie" e "#vertices n m"
+static int LeCabecalho(leitor *l, int *n, int *m)
+{
+    pulaLinha(l);
+    if(!pulaToken(l))
+    {
+        erroLeitura(l, "faltou o cabecalho \"#vertices n m\"");
+        return 0;
+    }
+    if(!leInteiro(l, n) || !leInteiro(l, m) || *n < 1 || *m < 1)
+    {
+        erroLeitura(l, "esperado \"#vertices n m\" com n e m inteiros positivos");
+        return 0;
+    }
+    return 1;
+}
+
+// "rotulo x y z" do ponto q (a partir de 0) de total, ja escalado
+static int LePonto(leitor *l, long long q, long long total, f4d p)
+{
+    char msg[160];
+
+    if(!pulaToken(l))
+    {
+        snprintf(msg, sizeof(msg), "arquivo terminou no ponto %lld de %lld", q + 1, total);
+        erroLeitura(l, msg);
+        return 0;
+    }
+    if(!leFloat(l, &p[0]) || !leFloat(l, &p[1]) || !leFloat(l, &p[2]))
+    {
+        snprintf(msg, sizeof(msg), "coordenada invalida no ponto %lld (esperado \"rotulo x y z\")", q + 1);
+        erroLeitura(l, msg);
+        return 0;
+    }
+
+    p[0] *= local_scale;
+    p[1] *= local_scale;
+    p[2] *= local_scale;
+    p[3] = 0.0f;
+    return 1;
+}
+
+// leitura em paralelo de arquivos grandes: o corpo e dividido em pedacos
+// terminados em '\n' e cada tarefa le os pontos do seu pedaco para um
+// vetor proprio. Qualquer anomalia (erro, ponto quebrado entre linhas,
+// pontos a menos) devolve 0 e a leitura sequencial refaz o trabalho, com
+// a mensagem de erro na linha certa.
+#define LEITURA_PARALELA (1 << 20)   // corpo minimo (bytes) para dividir
+
+typedef struct st_pedacoLeitura
+{
+    const char *ini, *fim;
+    float *xyz;
+    int nPts, inicio, ok;
+} pedacoLeitura;
+
+typedef struct st_leituraParalela
+{
+    pedacoLeitura *ped;
+    matriz *dest;
+    int total;
+} leituraParalela;
+
+static void lePedaco(int k, void *arg)
+{
+    pedacoLeitura *pd = ((leituraParalela*) arg)->ped + k;
+    leitor l;
+    int cap;
+
+    l.p = l.inicioLinha = pd->ini;
+    l.fim = pd->fim;
+    l.linha = 1;
+    l.arq = "";
+
+    cap = (int)((pd->fim - pd->ini) / 8) + 1;
+    pd->xyz = (float*) malloc((size_t) cap * 3 * sizeof(float));
+    pd->nPts = 0;
+    pd->ok = 0;
+    if(!pd->xyz) return;
+
+    while(pulaToken(&l))
+    {
+        if(pd->nPts == cap) return;
+        if(!leFloat(&l, &pd->xyz[3*pd->nPts]) || !leFloat(&l, &pd->xyz[3*pd->nPts + 1]) ||
+           !leFloat(&l, &pd->xyz[3*pd->nPts + 2]))
+            return;
+        pd->nPts++;
+    }
+    pd->ok = 1;
+}
+
+static void copiaPedaco(int k, void *arg)
+{
+    leituraParalela *lp = (leituraParalela*) arg;
+    pedacoLeitura *pd = lp->ped + k;
+    int q, i, lin, col, m = lp->dest->m;
+    f4d *dest;
+
+    // ponto q na linha q / m, coluna q % m (as linhas tem colunas fantasmas)
+    lin = pd->inicio / m;
+    col = pd->inicio % m;
+    for(i = 0, q = pd->inicio; i < pd->nPts && q < lp->total; i++, q++)
+    {
+        dest = lp->dest->ponto[lin] + col;
+        (*dest)[0] = pd->xyz[3*i] * local_scale;
+        (*dest)[1] = pd->xyz[3*i + 1] * local_scale;
+        (*dest)[2] = pd->xyz[3*i + 2] * local_scale;
+        (*dest)[3] = 0.0f;
+        if(++col == m)
+        {
+            col = 0;
+            lin++;
+        }
+    }
+}
+
+static int LePontosParalelo(const leitor *l, matriz *dest)
+{
+    leituraParalela lp;
+    int k, nPed, soma, ok;
+    size_t passo;
+    const char *p;
+
+    nPed = ThreadsEfetivas() * 4;
+    passo = (size_t)(l->fim - l->p) / nPed + 1;
+
+    // sem memoria para os pedacos o chamador le em serie (LePonto)
+    if((lp.ped = (pedacoLeitura*) calloc(nPed, sizeof(pedacoLeitura))) == NULL) return 0;
+    lp.dest = dest;
+    lp.total = dest->n * dest->m;
+
+    for(k = 0, p = l->p; k < nPed; k++)
+    {
+        lp.ped[k].ini = p;
+        if((size_t)(l->fim - p) <= passo) p = l->fim;
+        else
+        {
+            p = (const char*) memchr(p + passo, '\n', l->fim - (p + passo));
+            p = p ? p + 1 : l->fim;
+        }
+        lp.ped[k].fim = p;
+    }
+
+    paraleloPara(nPed, lePedaco, &lp);
+
+    ok = 1;
+    for(k = 0, soma = 0; k < nPed; k++)
+    {
+        ok = ok && lp.ped[k].ok;
+        lp.ped[k].inicio = soma;
+        soma += lp.ped[k].nPts;
+    }
+    ok = ok && soma >= lp.total;
+
+    if(ok) paraleloPara(nPed, copiaPedaco, &lp);
+
+    for(k = 0; k < nPed; k++) free(lp.ped[k].xyz);
+    free(lp.ped);
+    return ok;
+}
+
+// ---- cache binario (.stb) ----
+// Guarda a grade de pontos de controle ja escalada e, opcionalmente, a malha
+// tesselada para uma base/resolucao. Todos os vetores comecam em multiplos
+// de 64 bytes, entao o arquivo e mapeado e usado direto: pc e cacheSup.sup
+// apontam para o mapa, sem copia. Usado com -cache: CarregaPontos("x.txt")
+// procura "x.txt.stb" e so o aceita se o hash do texto de x.txt (e a
+// escala) baterem; senao le o texto e grava o .stb depois da primeira
+// tesselacao. Cada linha da grade vem com as FANTASMAS colunas de volta.
+#define BIN_MAGICA   "STRIBIN"
+#define BIN_VERSAO   2
+#define BIN_ALINHA(x) (((x) + 63) & ~(uint64_t)63)
+
+typedef struct st_cabecalhoBin
+{
+    char magica[8];
+    uint32_t versao, tamCabecalho;
+    uint64_t hashFonte;         // hash do texto de origem (0 = sem origem)
+    uint64_t tamArquivo;
+    float escala;               // local_scale aplicada aos pontos
+    int32_t n, m;
+    int32_t temMalha;
+    // chave da malha (mesmos campos de cacheSuperficie)
+    int32_t tipoBase, modo, tess;
+    float varia, tol;
+    int32_t nVert, nTri, nLin;
+    uint64_t offPontos, offVert, offNormal, offTri, offCorTri, offLin;
+} cabecalhoBin;
+
+int usaCacheBin = 0;                  // -cache
+static arquivoMapeado binAtual;       // .stb em uso por pc e/ou cacheSup.sup
+static char binPendente[1024];        // .stb a gravar na proxima tesselacao
+static uint64_t hashPendente;
+static matriz *pcNovo = NULL;         // grade de leitura, trocada com pc ao instalar
+
+// hash de 64 bits do conteudo, 8 bytes por passo
+uint64_t HashConteudo(const char *p, size_t tam)
+{
+    const uint64_t k1 = 0x9e3779b97f4a7c15ULL, k2 = 0xc2b2ae3d27d4eb4fULL;
+    uint64_t h = tam * k1, w;
+    size_t i;
+
+    for(i = 0; i + 8 <= tam; i += 8)
+    {
+        memcpy(&w, p + i, 8);
+        h ^= w * k2;
+        h = ((h << 31) | (h >> 33)) * k1;
+    }
+    for(w = 0; i < tam; i++) w = (w << 8) | (unsigned char) p[i];
+    h ^= w * k2;
+
+    // mistura final (fmix64)
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// a malha passa a pertencer ao heap de novo: a proxima tesselacao monta a
+// topologia do zero em vez de escrever no mapa (somente leitura)
+static void SoltaMalhaMapeada(cacheSuperficie *c)
+{
+    malha *sup = &c->sup;
+
+    if(!sup->mapeada) return;
+
+    sup->vert = sup->normal = NULL;
+    sup->tri = sup->lin = NULL;
+    sup->corTri = NULL;
+    sup->nVert = sup->nTri = sup->nLin = 0;
+    sup->mapeada = 0;
+
+    free(c->segS);
+    c->segS = NULL;
+    c->versao = -1;
+    c->geracao++;
+}
+
+// grade n x m cujas linhas (com as colunas fantasmas) apontam para dados,
+// sem copia; o bloco da matriz so guarda os ponteiros das linhas
+static matriz* MatrizSobre(f4d *dados, int n, int m)
+{
+    matriz *mat;
+    int i;
+
+    if((mat = (matriz*) calloc(1, sizeof(matriz))) == NULL) return NULL;
+    if((mat->bloco = malloc(n * sizeof(f4d*))) == NULL)
+    {
+        free(mat);
+        return NULL;
+    }
+    mat->tamBloco = n * sizeof(f4d*);
+    mat->n = n;
+    mat->m = m;
+    mat->fantasmas = FANTASMAS;
+    mat->ponto = (f4d**) mat->bloco;
+    for(i = 0; i < n; i++) mat->ponto[i] = dados + (size_t)i * (m + FANTASMAS);
+    return mat;
+}
+
+// troca pc pela grade nova e passa a usar o mapa (ou nenhum, se vazio);
+// o mapa anterior so e liberado depois que nada mais aponta para ele.
+// As colunas fantasmas de um .stb mapeado ja vem no arquivo.
+static void InstalaPc(matriz *novo, matriz **reserva, arquivoMapeado *mapa)
+{
+    matriz *velho = pc;
+
+    if(!mapa->tam) AtualizaFantasmas(novo, 0, novo->n);
+    pc = novo;
+    if(*reserva == novo) *reserva = velho;
+    else if(!*reserva) *reserva = velho;
+    else liberaMatriz(velho);
+
+    SoltaMalhaMapeada(&cacheSup);
+    DesmapeiaArquivo(&binAtual);
+    binAtual = *mapa;
+    mapa->tam = 0;
+
+    binPendente[0] = '\0';
+    versaoPc++;
+    ModeloIdentidade();
+}
+
+// count elementos de tamElem bytes a partir de off cabem em tam bytes
+// (sem somar, para que valores enormes nao deem a volta em 64 bits)
+static int cabeNoArquivo(uint64_t off, uint64_t count, uint64_t tamElem, uint64_t tam)
+{
+    return off <= tam && count <= (tam - off) / tamElem;
+}
+
+static int binValido(const arquivoMapeado *a, const cabecalhoBin *h)
+{
+    uint64_t pts;
+
+    if(a->tam < sizeof(cabecalhoBin) || memcmp(h->magica, BIN_MAGICA, 8) != 0) return 0;
+    if(h->versao != BIN_VERSAO || h->tamCabecalho != sizeof(cabecalhoBin)) return 0;
+    if(h->tamArquivo != a->tam || h->n < 1 || h->m < 1) return 0;
+
+    // a grade e percorrida com indices int
+    if(h->m > INT_MAX - FANTASMAS || h->n > INT_MAX / (h->m + FANTASMAS)) return 0;
+    pts = (uint64_t) h->n * (h->m + FANTASMAS);
+    if(h->offPontos % 64 || !cabeNoArquivo(h->offPontos, pts, sizeof(f4d), a->tam)) return 0;
+    if(!h->temMalha) return 1;
+
+    if(h->nVert < 0 || h->nTri < 0 || h->nLin < 0) return 0;
+    if(h->nTri > INT_MAX / 3 || h->nLin > INT_MAX / 2) return 0;
+    if(h->offVert % 64 || h->offNormal % 64 || h->offTri % 64 || h->offLin % 64) return 0;
+    return cabeNoArquivo(h->offVert, h->nVert, sizeof(f4d), a->tam) &&
+           cabeNoArquivo(h->offNormal, h->nVert, sizeof(f4d), a->tam) &&
+           cabeNoArquivo(h->offTri, (uint64_t) h->nTri * 3, sizeof(uint32_t), a->tam) &&
+           cabeNoArquivo(h->offCorTri, h->nTri, 1, a->tam) &&
+           cabeNoArquivo(h->offLin, (uint64_t) h->nLin * 2, sizeof(uint32_t), a->tam);
+}
+
+// indices dentro da malha: um arquivo truncado ou corrompido nao pode
+// fazer o desenho ler fora dos vetores
+static int malhaBinValida(const cabecalhoBin *h, const char *base)
+{
+    const uint32_t *tri = (const uint32_t*)(base + h->offTri);
+    const uint32_t *lin = (const uint32_t*)(base + h->offLin);
+    const unsigned char *cor = (const unsigned char*)(base + h->offCorTri);
+    int k;
+
+    for(k = 0; k < 3 * h->nTri; k++) if(tri[k] >= (uint32_t) h->nVert) return 0;
+    for(k = 0; k < 2 * h->nLin; k++) if(lin[k] >= (uint32_t) h->nVert) return 0;
+    for(k = 0; k < h->nTri; k++) if(cor[k] > 3) return 0;
+    return 1;
+}
+
+// carrega um .stb. Com verifica, so aceita o arquivo se ele veio de um
+// texto com o hash dado e com a escala atual (cache); sem verifica, o
+// proprio .stb e a entrada. Em caso de falha pc nao muda.
+int CarregaBinario(const char *arq, int verifica, uint64_t hash, matriz **reserva)
+{
+    arquivoMapeado a;
+    const cabecalhoBin *h;
+    matriz *novo;
+    cacheSuperficie *c = &cacheSup;
+
+    if(!MapeiaArquivo(arq, &a))
+    {
+        if(!verifica) printf("Error en la apertura del archivo %s \n", arq);
+        return 0;
+    }
+
+    h = (const cabecalhoBin*) a.dados;
+    if(!binValido(&a, h) || (h->temMalha && !malhaBinValida(h, a.dados)))
+    {
+        printf("%s: arquivo binario invalido ou de outra versao\n", arq);
+        DesmapeiaArquivo(&a);
+        return 0;
+    }
+    if(verifica && (h->hashFonte != hash || h->escala != local_scale))
+    {
+        printf("%s: desatualizado (o texto de origem mudou)\n", arq);
+        DesmapeiaArquivo(&a);
+        return 0;
+    }
+
+    if((novo = MatrizSobre((f4d*)(a.dados + h->offPontos), h->n, h->m)) == NULL)
+    {
+        DesmapeiaArquivo(&a);
+        return 0;
+    }
+    InstalaPc(novo, reserva, &a);
+
+    if(h->temMalha)
+    {
+        // a malha do arquivo vale enquanto a base/resolucao forem as dela
+        if(!c->sup.mapeada)
+        {
+            free(c->sup.vert);
+            free(c->sup.normal);
+            free(c->sup.tri);
+            free(c->sup.corTri);
+            free(c->sup.lin);
+            c->sup.tamVert = c->sup.tamNormal = c->sup.tamTri = c->sup.tamCorTri = c->sup.tamLin = 0;
+        }
+        c->sup.vert = (f4d*)(binAtual.dados + h->offVert);
+        c->sup.normal = (f4d*)(binAtual.dados + h->offNormal);
+        c->sup.tri = (unsigned int*)(binAtual.dados + h->offTri);
+        c->sup.corTri = (unsigned char*)(binAtual.dados + h->offCorTri);
+        c->sup.lin = (unsigned int*)(binAtual.dados + h->offLin);
+        c->sup.nVert = h->nVert;
+        c->sup.nTri = h->nTri;
+        c->sup.nLin = h->nLin;
+        c->sup.mapeada = 1;
+
+        free(c->segS);
+        c->segS = NULL;
+        c->tipoBase = h->tipoBase;
+        c->varia = h->varia;
+        c->modo = h->modo;
+        c->tess = h->tess;
+        c->tol = h->tol;
+        c->nLinhasPatch = h->n - 3;
+        c->nColunasPatch = h->m;
+        c->versao = versaoPc;
+        c->geracao++;
+    }
+    else if(verifica)
+    {
+        snprintf(binPendente, sizeof(binPendente), "%s", arq);
+        hashPendente = hash;
+    }
+
+    printf(" %s: %d x %d pontos", arq, h->n, h->m);
+    if(h->temMalha) printf(", malha com %d vertices e %d triangulos", h->nVert, h->nTri);
+    printf("\n");
+    return 1;
+}
+
+static int gravaBloco(FILE *f, uint64_t off, const void *dados, size_t bytes)
+{
+    static const char zeros[64] = {0};
+    long pos = ftell(f);
+
+    if(pos < 0 || (uint64_t) pos > off) return 0;
+    if(fwrite(zeros, 1, off - pos, f) != off - pos) return 0;
+    return fwrite(dados, 1, bytes, f) == bytes;
+}
+
+// grava pc (e a malha de c, se houver) em arq; hash e o do texto de origem.
+// Escreve num temporario e renomeia, entao um .stb mapeado por outro
+// processo (ou por este) continua valido.
+int GravaBinario(const char *arq, uint64_t hash, cacheSuperficie *c)
+{
+    cabecalhoBin h;
+    FILE *f;
+    char tmp[1100];
+    uint64_t pts;
+    int i, ok;
+    malha *sup = c ? &c->sup : NULL;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magica, BIN_MAGICA, 8);
+    h.versao = BIN_VERSAO;
+    h.tamCabecalho = sizeof(h);
+    h.hashFonte = hash;
+    h.escala = local_scale;
+    h.n = pc->n;
+    h.m = pc->m;
+
+    pts = (uint64_t) pc->n * (pc->m + FANTASMAS);
+    h.offPontos = BIN_ALINHA(sizeof(h));
+    h.tamArquivo = h.offPontos + pts * sizeof(f4d);
+
+    if(sup && sup->vert)
+    {
+        h.temMalha = 1;
+        h.tipoBase = c->tipoBase;
+        h.modo = c->modo;
+        h.tess = c->tess;
+        h.varia = c->varia;
+        h.tol = c->tol;
+        h.nVert = sup->nVert;
+        h.nTri = sup->nTri;
+        h.nLin = sup->nLin;
+        h.offVert = BIN_ALINHA(h.tamArquivo);
+        h.offNormal = BIN_ALINHA(h.offVert + (uint64_t) h.nVert * sizeof(f4d));
+        h.offTri = BIN_ALINHA(h.offNormal + (uint64_t) h.nVert * sizeof(f4d));
+        h.offCorTri = BIN_ALINHA(h.offTri + (uint64_t) h.nTri * 3 * sizeof(uint32_t));
+        h.offLin = BIN_ALINHA(h.offCorTri + (uint64_t) h.nTri);
+        h.tamArquivo = h.offLin + (uint64_t) h.nLin * 2 * sizeof(uint32_t);
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", arq);
+    if((f = fopen(tmp, "wb")) == NULL)
+    {
+        printf("Erro ao criar o arquivo %s \n", tmp);
+        return 0;
+    }
+
+    ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    // as linhas de pc podem nao ser contiguas (grade mapeada ou nao)
+    for(i = 0; ok && i < pc->n; i++)
+        ok = gravaBloco(f, h.offPontos + (uint64_t) i * (pc->m + FANTASMAS) * sizeof(f4d), pc->ponto[i],
+                        (size_t)(pc->m + FANTASMAS) * sizeof(f4d));
+    if(ok && h.temMalha)
+        ok = gravaBloco(f, h.offVert, sup->vert, (size_t) h.nVert * sizeof(f4d)) &&
+             gravaBloco(f, h.offNormal, sup->normal, (size_t) h.nVert * sizeof(f4d)) &&
+             gravaBloco(f, h.offTri, sup->tri, (size_t) h.nTri * 3 * sizeof(uint32_t)) &&
+             gravaBloco(f, h.offCorTri, sup->corTri, (size_t) h.nTri) &&
+             gravaBloco(f, h.offLin, sup->lin, (size_t) h.nLin * 2 * sizeof(uint32_t));
+    if(fclose(f) != 0) ok = 0;
+
+#ifdef _WIN32
+    if(ok) remove(arq);
+#endif
+    if(!ok || rename(tmp, arq) != 0)
+    {
+        printf("Erro ao gravar o arquivo %s \n", arq);
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+// chamada no fim de AtualizaCache: grava o .stb pendente com a malha
+static void GravaCachePendente(cacheSuperficie *c)
+{
+    if(!binPendente[0]) return;
+
+    // a malha do LOD de tela depende da vista: grava so a rede
+    if(GravaBinario(binPendente, hashPendente, c->tess == TESS_TELA ? NULL : c))
+        printf(" cache %s gravado\n", binPendente);
+    binPendente[0] = '\0';
+}
+
+// ---- edicao de pontos de controle (API) ----
+// marca os patches que dependem do ponto (i, j). Sem um cache valido de
+// tesselacao uniforme, ou com edicoes acumuladas demais, a proxima
+// reavaliacao e inteira.
+static void MarcaPatchesSujos(cacheSuperficie *c, int i, int j)
+{
+    int pi, d, p;
+    int nn = c->nLinhasPatch, mm = c->nColunasPatch;
+
+    if(!c->segS || !CacheValido(c) || c->tess != TESS_UNIFORME || c->nSujos + 16 > c->nPatches / 4)
+    {
+        versaoPc++;
+        return;
+    }
+
+    if(!Cresce(&c->listaSujos, &c->tamListaSujos, (size_t)(c->nSujos + 16) * sizeof(int)))
+    {
+        versaoPc++;
+        return;
+    }
+    for(pi = i - 3; pi <= i; pi++)
+    {
+        if(pi < 0 || pi >= nn) continue;
+        for(d = 0; d < 4; d++)
+        {
+            p = pi * mm + ((j - d) % mm + mm) % mm;
+            if(c->sujo[p]) continue;
+            c->sujo[p] = 1;
+            c->listaSujos[c->nSujos++] = p;
+        }
+    }
+}
+
+// passa pc (e a malha) do .stb mapeado, somente leitura, para o heap
+static void PcNoHeap(void)
+{
+    arquivoMapeado semMapa;
+    f4d modelo[3];
+    int i;
+
+    if(pcNovo) i = RedimensionaMatriz(pcNovo, pc->n, pc->m);
+    else i = (pcNovo = AlocaRede(pc->n, pc->m)) != NULL;
+    if(!i) return;
+    for(i = 0; i < pc->n; i++) memcpy(pcNovo->ponto[i], pc->ponto[i], pc->m * sizeof(f4d));
+
+    // a rede e a mesma: a transformacao do objeto continua
+    memcpy(modelo, matModelo, sizeof(modelo));
+    semMapa.tam = 0;
+    InstalaPc(pcNovo, &pcNovo, &semMapa);
+    memcpy(matModelo, modelo, sizeof(modelo));
+}
+
+// altera o ponto (i, j) de pc (coordenadas do objeto, ja escaladas). So
+// os patches que dependem dele sao reavaliados no proximo desenho.
+int EditaPontoControle(int i, int j, const f4d p)
+{
+    int passo, fim;
+
+    if(!pc || i < 0 || i >= pc->n || j < 0 || j >= pc->m) return 0;
+
+    if(binAtual.tam) PcNoHeap();
+    if(binAtual.tam) return 0;
+
+    pc->ponto[i][j][X] = p[X];
+    pc->ponto[i][j][Y] = p[Y];
+    pc->ponto[i][j][Z] = p[Z];
+    AtualizaFantasmas(pc, i, i + 1);
+
+    // o .stb ainda nao gravado seria do arquivo, nao da rede editada
+    binPendente[0] = '\0';
+
+    // as primeiras colunas tambem mudam as fantasmas, no fim da linha
+    passo = pc->m + pc->fantasmas;
+    fim = j < pc->fantasmas ? (i + 1) * passo : i * passo + j + 1;
+    if(ctrlEditIni < 0 || i * passo + j < ctrlEditIni) ctrlEditIni = i * passo + j;
+    if(fim > ctrlEditFim) ctrlEditFim = fim;
+
+    if(pc->n >= 4) MarcaPatchesSujos(&cacheSup, i, j);
+    return 1;
+}
+
+// le o arquivo de pontos de controle para pc. Em caso de erro mostra
+// arquivo:linha:coluna e deixa pc como estava. Arquivos .stb sao lidos
+// como binarios; com -cache o .stb ao lado do texto e usado se valido.
+int CarregaPontos( char *arch)
+{
+  arquivoMapeado arq, semMapa;
+  leitor l;
+  int i, j, n, m;
+  size_t tamNome;
+  char msg[160], nomeCache[1024];
+  uint64_t hash = 0;
+  std::chrono::steady_clock::time_point t0;
+
+  printf(" \n ler  %s  \n", arch);
+  t0 = std::chrono::steady_clock::now();
+
+  tamNome = strlen(arch);
+  if(tamNome > 4 && strcmp(arch + tamNome - 4, ".stb") == 0)
+     return CarregaBinario(arch, 0, 0, &pcNovo);
+
+  if(!MapeiaArquivo(arch, &arq))
+  {
+     printf("Error en la apertura del archivo %s \n", arch);
+     return 0;
+  }
+
+  if(usaCacheBin)
+  {
+     hash = HashConteudo(arq.dados, arq.tam);
+     snprintf(nomeCache, sizeof(nomeCache), "%s.stb", arch);
+     if(CarregaBinario(nomeCache, 1, hash, &pcNovo))
+     {
+        DesmapeiaArquivo(&arq);
+        printf(" cache em %.2f ms\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3);
+        return 1;
+     }
+  }
+
+  l.p = l.inicioLinha = arq.dados;
+  l.fim = arq.dados + arq.tam;
+  l.linha = 1;
+  l.arq = arch;
+
+  if(!LeCabecalho(&l, &n, &m))
+  {
+     DesmapeiaArquivo(&arq);
+     return 0;
+  }
+  // cada ponto ocupa pelo menos 8 bytes ("v 0 0 0\n"): evita alocar a
+  // grade de um cabecalho corrompido
+  if((unsigned long long) n * m > arq.tam / 8 + 1)
+  {
+     snprintf(msg, sizeof(msg), "o cabecalho pede %d x %d pontos, mais do que cabe no arquivo", n, m);
+     erroLeitura(&l, msg);
+     DesmapeiaArquivo(&arq);
+     return 0;
+  }
+
+  if (pcNovo) i = RedimensionaMatriz(pcNovo, n, m);
+  else i = (pcNovo = AlocaRede(n, m)) != NULL;
+  if(!i)
+  {
+     DesmapeiaArquivo(&arq);
+     return 0;
+  }
+
+  j = 0;
+  if(ThreadsEfetivas() > 1 && l.fim - l.p >= LEITURA_PARALELA && LePontosParalelo(&l, pcNovo))
+      j = n;   // ja lidos
+
+  for(; j<n; j++)
+  {
+    for(i=0; i<m; i++)
+     {
+         if(!LePonto(&l, j * m + i, n * m, pcNovo->ponto[j][i]))
+         {
+             DesmapeiaArquivo(&arq);
+             return 0;
+         }
+     }
+  }
+  DesmapeiaArquivo(&arq);
+
+  semMapa.tam = 0;
+  InstalaPc(pcNovo, &pcNovo, &semMapa);
+  if(usaCacheBin)
+  {
+     snprintf(binPendente, sizeof(binPendente), "%s", nomeCache);
+     hashPendente = hash;
+  }
+
+  printf(" %d x %d pontos em %.2f ms\n", n, m,
+         std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3);
+  return 1;
+}
+
+// tempo medio (s) para reavaliar todos os patches do objeto carregado
+static double tempoAtualizaCache(int repeticoes)
+{
+    int r;
+    std::chrono::steady_clock::time_point t0;
+
+    t0 = std::chrono::steady_clock::now();
+    for(r = 0; r < repeticoes; r++)
+    {
+        versaoPc++;
+        AtualizaCache(&cacheSup);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / repeticoes;
+}
+
+// -bench: compara a forma matricial (em cada kernel) com as diferencas
+// progressivas, em amostras por segundo e em erro maximo/RMS, sem abrir
+// janela. Roda em uma thread para medir o custo por nucleo. No fim mede
+// os kernels de iluminacao em vertices por segundo.
+void BenchmarkAvaliadores(void)
+{
+    const char *arquivos[] = {"ptosControleCilindro4x4.txt", "ptosControleCubo4x4.txt",
+                              "ptosControleEsfera4x4.txt"};
+    int bases[] = {BEZIER, BSPLINE, CATMULLROM};
+    const char *nomeBase[] = {"bezier", "bspline", "catmullrom"};
+    float varias[] = {0.04f, 0.01f, 0.0025f};
+    double taxa[4], erro, erroMax, somaErro2;
+    long amostras, q;
+    int a, b, v, nivel, r, h;
+    float *ref, *luz;
+    f4d *vert;
+    std::chrono::steady_clock::time_point t0;
+
+    numThreads = 1;
+
+    printf("%-28s %-10s %7s %9s %9s %9s %9s %9s %11s %11s\n", "arquivo", "base", "VARIA",
+           "amostras", "escalar", "sse", "avx2", "difer.", "erroMax", "erroRMS");
+    printf("%-28s %-10s %7s %9s %9s %9s %9s %9s\n", "", "", "", "", "Ma/s", "Ma/s", "Ma/s", "Ma/s");
+
+    for(a = 0; a < 3; a++)
+    {
+        if(!CarregaPontos((char*) arquivos[a]) || pc->n < 4) continue;
+
+        for(b = 0; b < 3; b++)
+        {
+            MontaMatrizBase(bases[b]);
+
+            for(v = 0; v < 3; v++)
+            {
+                VARIA = varias[v];
+
+                modoAvaliacao = AVAL_MATRIZ;
+                EscolheKernelSuperficie(KERNEL_ESCALAR);
+                AtualizaCache(&cacheSup);
+                amostras = cacheSup.sup.nVert;
+                r = (int)(20000000L / amostras) + 1;
+
+                // referencia: forma matricial
+                ref = (float*) malloc(amostras * 3 * sizeof(float));
+                vert = cacheSup.sup.vert;
+                for(q = 0; q < amostras; q++)
+                    for(h = 0; h < 3; h++) ref[q*3 + h] = vert[q][h];
+
+                for(nivel = KERNEL_ESCALAR; nivel <= KERNEL_AVX2; nivel++)
+                {
+                    EscolheKernelSuperficie(nivel);
+                    taxa[nivel] = nivelKernel == nivel ? amostras / tempoAtualizaCache(r) / 1e6 : 0.0;
+                }
+
+                modoAvaliacao = AVAL_DIFERENCAS;
+                taxa[3] = amostras / tempoAtualizaCache(r) / 1e6;
+
+                erroMax = somaErro2 = 0.0;
+                vert = cacheSup.sup.vert;
+                for(q = 0; q < amostras; q++)
+                    for(h = 0; h < 3; h++)
+                    {
+                        erro = fabs(vert[q][h] - ref[q*3 + h]);
+                        if(erro > erroMax) erroMax = erro;
+                        somaErro2 += erro * erro;
+                    }
+                free(ref);
+
+                printf("%-28s %-10s %7.4f %9ld %9.1f %9.1f %9.1f %9.1f %11.3e %11.3e\n",
+                       arquivos[a], nomeBase[b], VARIA, amostras, taxa[0], taxa[1], taxa[2],
+                       taxa[3], erroMax, sqrt(somaErro2 / (amostras * 3)));
+            }
+        }
+    }
+
+    // triangulos da tesselacao uniforme (VARIA = 0.04) x adaptativa
+    printf("\n%-28s %-10s %9s %11s %11s\n", "arquivo", "base", "tolCorda", "uniforme", "adaptativa");
+    modoAvaliacao = AVAL_MATRIZ;
+    VARIA = 0.04f;
+    for(a = 0; a < 3; a++)
+    {
+        if(!CarregaPontos((char*) arquivos[a]) || pc->n < 4) continue;
+
+        for(b = 0; b < 3; b++)
+        {
+            MontaMatrizBase(bases[b]);
+
+            modoTesselacao = TESS_UNIFORME;
+            AtualizaCache(&cacheSup);
+            amostras = cacheSup.sup.nTri;
+
+            modoTesselacao = TESS_ADAPTATIVA;
+            AtualizaCache(&cacheSup);
+            printf("%-28s %-10s %9.4f %11ld %11ld\n", arquivos[a], nomeBase[b], tolCorda,
+                   amostras, (long) cacheSup.sup.nTri);
+        }
+    }
+
+    modoTesselacao = TESS_UNIFORME;
+
+    // iluminacao em lote dos vertices (todas as luzes), por kernel
+    printf("\n%-28s %-10s %9s %9s %9s %9s %11s\n", "arquivo", "base", "vertices",
+           "escalar", "sse", "avx2", "erroMax");
+    printf("%-28s %-10s %9s %9s %9s %9s\n", "", "", "", "Mv/s", "Mv/s", "Mv/s");
+    VARIA = 0.01f;
+    for(a = 0; a < 3; a++)
+    {
+        if(!CarregaPontos((char*) arquivos[a]) || pc->n < 4) continue;
+
+        MontaMatrizBase(BSPLINE);
+        AtualizaCache(&cacheSup);
+        amostras = cacheSup.sup.nVert;
+        r = (int)(20000000L / amostras) + 1;
+
+        ref = (float*) malloc(amostras * sizeof(float));
+        luz = (float*) malloc(amostras * sizeof(float));
+        EscolheKernelSuperficie(KERNEL_ESCALAR);
+        IluminaVertices(&cacheSup.sup, ref);
+
+        erroMax = 0.0;
+        for(nivel = KERNEL_ESCALAR; nivel <= KERNEL_AVX2; nivel++)
+        {
+            EscolheKernelSuperficie(nivel);
+            taxa[nivel] = 0.0;
+            if(nivelKernel != nivel) continue;
+
+            t0 = std::chrono::steady_clock::now();
+            for(v = 0; v < r; v++) IluminaVertices(&cacheSup.sup, luz);
+            taxa[nivel] = amostras * (double) r / 1e6 /
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+            for(q = 0; q < amostras; q++)
+                erroMax = fmax(erroMax, fabs(luz[q] - ref[q]));
+        }
+        free(ref);
+        free(luz);
+
+        printf("%-28s %-10s %9ld %9.1f %9.1f %9.1f %11.3e\n", arquivos[a], nomeBase[1],
+               amostras, taxa[0], taxa[1], taxa[2], erroMax);
+    }
+
+    VARIA = 0.04f;
+    EscolheKernelSuperficie(KERNEL_AVX2);
+}
+
+// ---- rasterizacao em CPU (-imagem): a malha sem OpenGL ----
+// O rasterizador e o PNG ficam em comum/imagem.h. Aqui so se passam os
+// vertices para a janela, com a vista de reshape() (matModelo e o
+// glOrtho) e a iluminacao do modo Preenchido, e as tarefas do pool.
+
+#define RASTER_VERT    16384     // vertices por tarefa
+
+typedef struct st_rasterizador
+{
+    rasterImagem img;
+    const malha *sup;
+    fonteLuz fontes[MAX_LUZES];
+    float katt;
+    double ax, bx, ay, by, az, bz;   // objeto (ja em matModelo) -> janela
+    size_t tamXY, tamZ, tamLuz, tamContagem, tamInicio, tamLista, tamImagem;
+} rasterizador;
+
+rasterizador raster;
+
+static void rasterVertices(int k, void *arg)
+{
+    rasterizador *r = (rasterizador*) arg;
+    const malha *sup = r->sup;
+    int v, ini, fim, b;
+    float p[3];
+
+    ini = k * RASTER_VERT;
+    fim = ini + RASTER_VERT < sup->nVert ? ini + RASTER_VERT : sup->nVert;
+    kernelIluminacao(sup->vert + ini, sup->normal + ini, fim - ini, r->fontes, nLuzes, r->katt, r->img.luz + ini);
+
+    for(v = ini; v < fim; v++)
+    {
+        for(b = 0; b < 3; b++)
+            p[b] = sup->vert[v][X] * matModelo[X][b] + sup->vert[v][Y] * matModelo[Y][b] +
+                   sup->vert[v][Z] * matModelo[Z][b];
+
+        r->img.z[v] = (float)(p[Z] * r->az + r->bz);
+        rasterPosicao(p[X] * r->ax + r->bx, p[Y] * r->ay + r->by, &r->img.xy[2*v]);
+    }
+}
+
+// desenha a malha (modo solido) numa imagem larg x alt, RGB com a linha
+// 0 em cima, vista como numa janela desse tamanho. A imagem e reusada na
+// proxima chamada.
+const unsigned char* RasterizaMalha(malha *sup, int larg, int alt)
+{
+    rasterizador *r = &raster;
+    rasterImagem *img = &r->img;
+    double j[6];
+    size_t total;
+
+    if(larg <= 0 || alt <= 0 || !sup->vert) return NULL;
+
+    r->sup = sup;
+    rasterBlocos(img, larg, alt);
+    img->nTri = sup->nTri;
+    img->tri = sup->tri;
+    img->corTri = sup->corTri;
+    img->cores = vcolor;
+    img->paralelo = paraleloPara;
+
+    // glOrtho e viewport: objeto -> pixels da janela, z -> [-1, 1]
+    JanelaOrtho(larg, alt, j);
+    r->ax = larg / (j[1] - j[0]);  r->bx = -j[0] * r->ax;
+    r->ay = alt / (j[3] - j[2]);   r->by = -j[2] * r->ay;
+    r->az = -2.0 / (j[5] - j[4]);  r->bz = -(j[5] + j[4]) / (j[5] - j[4]);
+    LuzesNoObjeto(r->fontes, &r->katt);
+    if(!kernelIluminacao) EscolheKernelSuperficie(KERNEL_AVX2);
+
+    if(!Cresce(&img->xy, &r->tamXY, 2 * (size_t) sup->nVert * sizeof(int)) ||
+       !Cresce(&img->z, &r->tamZ, (size_t) sup->nVert * sizeof(float)) ||
+       !Cresce(&img->luz, &r->tamLuz, (size_t) sup->nVert * sizeof(float)) ||
+       !Cresce(&img->contagem, &r->tamContagem, (size_t) RASTER_GRUPOS * img->nBlocos * sizeof(size_t)) ||
+       !Cresce(&img->inicio, &r->tamInicio, ((size_t) img->nBlocos + 1) * sizeof(size_t)) ||
+       !Cresce(&img->imagem, &r->tamImagem, (size_t) larg * alt * 3))
+        return NULL;
+
+    paraleloPara((sup->nVert + RASTER_VERT - 1) / RASTER_VERT, rasterVertices, r);
+
+    total = rasterConta(img);
+    if(!Cresce(&img->lista, &r->tamLista, (total ? total : 1) * sizeof(int))) return NULL;
+    rasterDesenha(img);
+    return img->imagem;
+}
+
+// ---- -microbench: cada etapa da avaliacao, em CSV ou JSON ----
+// Percorre as redes distribuidas e redes sinteticas maiores, as tres bases
+// e varios VARIA, e grava um registro por (etapa, rede, base, VARIA) com
+// amostras/s e ns/triangulo. Roda em uma thread, como o -bench.
+
+typedef struct st_saidaBench
+{
+    FILE *f;
+    int json;
+    int registros;
+} saidaBench;
+
+typedef struct st_casoBench
+{
+    const char *rede, *base;
+    int n, m;
+    float varia;
+    long amostras, triangulos;
+} casoBench;
+
+static void registraBench(saidaBench *s, const casoBench *c, const char *etapa, double seg)
+{
+    const char *nomeKernel[] = {"escalar", "sse", "avx2"};
+    double taxa, nsTri;
+
+    taxa = seg > 0.0 ? c->amostras / seg : 0.0;
+    nsTri = c->triangulos > 0 ? seg * 1e9 / c->triangulos : 0.0;
+
+    if(s->json)
+        fprintf(s->f, "%s\n  {\"etapa\": \"%s\", \"rede\": \"%s\", \"base\": \"%s\", \"n\": %d, "
+                "\"m\": %d, \"varia\": %g, \"kernel\": \"%s\", \"amostras\": %ld, \"triangulos\": %ld, "
+                "\"segundos\": %.9g, \"amostras_s\": %.6g, \"ns_triangulo\": %.6g}",
+                s->registros ? "," : "", etapa, c->rede, c->base, c->n, c->m, c->varia,
+                nomeKernel[nivelKernel], c->amostras, c->triangulos, seg, taxa, nsTri);
+    else
+        fprintf(s->f, "%s,%s,%s,%d,%d,%g,%s,%ld,%ld,%.9g,%.6g,%.6g\n", etapa, c->rede, c->base,
+                c->n, c->m, c->varia, nomeKernel[nivelKernel], c->amostras, c->triangulos, seg, taxa, nsTri);
+    s->registros++;
+}
+
+// repete passo ate somar ao menos 50 ms; devolve o tempo medio (s)
+typedef void (*passoBench)(void *arg);
+
+static double medeBench(passoBench passo, void *arg)
+{
+    std::chrono::steady_clock::time_point t0;
+    double seg;
+    long r = 0;
+
+    t0 = std::chrono::steady_clock::now();
+    do
+    {
+        passo(arg);
+        r++;
+        seg = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    } while(seg < 0.05);
+
+    return seg / r;
+}
+
+static volatile float sumidouroBench;   // impede que o compilador descarte o trabalho
+
+static void passoTesselacao(void *arg)
+{
+    versaoPc++;
+    AtualizaCache((cacheSuperficie*) arg);
+}
+
+// so o avaliador: todos os patches em um buffer de rascunho, sem malha
+static void passoPtsSuperficie(void *arg)
+{
+    static f4d *buf = NULL, *bufN = NULL;
+    static int cap = 0;
+    int k, nS = tabPesos.n, comNormal = arg != NULL;
+    matriz bez;
+    f4d *linhas[4];
+
+    if(cap < nS * nS)
+    {
+        free(buf);
+        free(bufN);
+        buf = (f4d*) malloc((size_t) nS * nS * sizeof(f4d));
+        bufN = (f4d*) malloc((size_t) nS * nS * sizeof(f4d));
+        cap = nS * nS;
+    }
+
+    for(k = 0; k < cacheSup.nBezier; k++)
+    {
+        PatchBezier(&cacheSup, k, &bez, linhas);
+        ptsSuperficie(&bez, &tabPesos, &tabPesos, nS, nS, buf, comNormal ? bufN : NULL, nS);
+    }
+    sumidouroBench = buf[0][X];
+}
+
+static void passoNormalTri(void *arg)
+{
+    malha *sup = (malha*) arg;
+    f4d n;
+    float soma = 0.0f;
+    int k;
+
+    for(k = 0; k < sup->nTri; k++)
+    {
+        calcNormalTri(sup->vert[sup->tri[3*k]], sup->vert[sup->tri[3*k+1]],
+                      sup->vert[sup->tri[3*k+2]], n);
+        soma += n[X];
+    }
+    sumidouroBench = soma;
+}
+
+static void passoLuzContrib(void *arg)
+{
+    malha *sup = (malha*) arg;
+    float soma = 0.0f;
+    int v, k;
+
+    for(v = 0; v < sup->nVert; v++)
+        for(k = 0; k < nLuzes; k++)
+            soma += luzContrib(luzes[k].pos, sup->normal[v], sup->vert[v], ATENUACAO);
+    sumidouroBench = soma;
+}
+
+static void passoIluminacao(void *arg)
+{
+    static float *luz = NULL;
+    static int cap = 0;
+    malha *sup = (malha*) arg;
+
+    if(cap < sup->nVert)
+    {
+        free(luz);
+        luz = (float*) malloc(sup->nVert * sizeof(float));
+        cap = sup->nVert;
+    }
+    IluminaVertices(sup, luz);
+    sumidouroBench = luz[0];
+}
+
+// edicao de um ponto do meio da rede e a reavaliacao que ela causa
+static void passoEdicao(void *)
+{
+    static float sinal = 1.0f;
+    f4d p;
+    int i = pc->n / 2, j = pc->m / 2;
+
+    memcpy(p, pc->ponto[i][j], sizeof(f4d));
+    p[Z] += sinal * 0.01f;
+    sinal = -sinal;
+    EditaPontoControle(i, j, p);
+
+    if(!CacheValido(&cacheSup)) AtualizaCache(&cacheSup);
+    else if(cacheSup.nSujos) AtualizaPatchesSujos(&cacheSup);
+    sumidouroBench = cacheSup.sup.vert[0][X];
+}
+
+// bases de spline.h contra MatBase lida em tempo de execucao (como o
+// ptoCurva antigo dos programas de curvas): B < 0 usa MatBase
+
+// 1024 pontos da curva dos 4 primeiros pontos da linha 0 de pc
+template<int B> static void passoCurva(void *)
+{
+    float g[4][3], p[3], t, soma = 0.0f;
+    int a, k;
+
+    for(a = 0; a < 4; a++) memcpy(g[a], pc->ponto[0][a % pc->m], sizeof(g[a]));
+
+    for(k = 0; k < 1024; k++)
+    {
+        t = k / 1023.0f;
+        if(B < 0) splinePontoMatriz(MatBase, t, g, p);
+        else spline::ponto<(B < 0 ? 0 : B)>(t, g, p);
+        soma += p[X] + p[Y] + p[Z];
+    }
+    sumidouroBench = soma;
+}
+
+// C = M P M^t de cada patch de pc (sem a volta das colunas)
+template<int B> static void passoCoeficientes(void *)
+{
+    f4d C[4][4];
+    float (*linha[4])[4];
+    float soma = 0.0f;
+    int i, j, k, a, b;
+
+    for(i = 0; i + 3 < pc->n; i++)
+        for(j = 0; j + 3 < pc->m; j++)
+        {
+            for(k = 0; k < 4; k++) linha[k] = pc->ponto[i+k] + j;
+            if(B < 0) splineCoeficientesPatchMatriz(MatBase, linha, C);
+            else spline::coeficientesPatch<(B < 0 ? 0 : B)>(linha, C);
+            for(a = 0; a < 4; a++)
+                for(b = 0; b < 4; b++) soma += C[a][b][X] + C[a][b][Y] + C[a][b][Z];
+        }
+    sumidouroBench = soma;
+}
+
+// conversao de todos os patches de pc para a forma de Bezier
+static void passoConversao(void *arg)
+{
+    cacheSuperficie *c = (cacheSuperficie*) arg;
+
+    c->versaoBezier = -1;
+    ConvertePatches(c);
+    sumidouroBench = c->bezier ? c->bezier[0][X] : 0.0f;
+}
+
+static void passoRasterizacao(void *arg)
+{
+    const unsigned char *img = RasterizaMalha((malha*) arg, 3840, 2160);
+
+    sumidouroBench = img ? img[0] : 0.0f;
+}
+
+// as matrizes globais voltam como estavam, para o passo nao mudar a vista
+// dos casos seguintes
+static void passoMultMatriz(void *)
+{
+    f4d modelo[3], aux[3];
+    int k;
+
+    memcpy(modelo, matModelo, sizeof(modelo));
+    memcpy(aux, AuxVertex, sizeof(aux));
+
+    // rotacao de 0.01 rad em z, como uma seta em GirarZ
+    MatrizIdentidade();
+    AuxVertex[0][0] = cos(0.01);  AuxVertex[0][1] = sin(0.01);
+    AuxVertex[1][0] = -sin(0.01); AuxVertex[1][1] = cos(0.01);
+    for(k = 0; k < 1000; k++) MultMatriz();
+    sumidouroBench = matModelo[0][0];
+
+    memcpy(matModelo, modelo, sizeof(modelo));
+    memcpy(AuxVertex, aux, sizeof(aux));
+    versaoModelo++;
+}
+
+// rede sintetica n x m: tubo fechado em t com raio ondulado ao longo de s
+static void RedeSintetica(int n, int m)
+{
+    arquivoMapeado semMapa;
+    int i, j;
+    float raio, ang;
+
+    if(pcNovo) RedimensionaMatriz(pcNovo, n, m);
+    else pcNovo = AlocaRede(n, m);
+
+    for(j = 0; j < n; j++)
+    {
+        raio = 3.0f + sinf(j * 0.7f) + 0.5f * cosf(j * 0.13f);
+        for(i = 0; i < m; i++)
+        {
+            ang = 2.0f * (float) M_PI * i / m;
+            pcNovo->ponto[j][i][X] = raio * cosf(ang);
+            pcNovo->ponto[j][i][Y] = raio * sinf(ang);
+            pcNovo->ponto[j][i][Z] = 8.0f - 16.0f * j / (n - 1);
+            pcNovo->ponto[j][i][3] = 0.0f;
+        }
+    }
+
+    semMapa.tam = 0;
+    InstalaPc(pcNovo, &pcNovo, &semMapa);
+}
+
+// -microbench [-json] [-o arquivo]
+int MicroBenchmark(int json, const char *arquivo)
+{
+    const char *arquivos[] = {"ptosControleCilindro4x4.txt", "ptosControleCubo4x4.txt",
+                              "ptosControleEsfera4x4.txt"};
+    int sintN[] = {16, 64, 256}, sintM[] = {8, 32, 64};
+    int bases[] = {BEZIER, BSPLINE, CATMULLROM};
+    const char *nomeBase[] = {"bezier", "bspline", "catmullrom"};
+    float varias[] = {0.2f, 0.1f, 0.04f, 0.02f};
+    char nomeRede[64];
+    saidaBench s;
+    casoBench c;
+    int r, b, v, seg, z, a;
+
+    s.json = json;
+    s.registros = 0;
+    if((s.f = fopen(arquivo, "w")) == NULL)
+    {
+        printf("Erro ao criar o arquivo %s \n", arquivo);
+        return 1;
+    }
+
+    if(json) fprintf(s.f, "[");
+    else fprintf(s.f, "etapa,rede,base,n,m,varia,kernel,amostras,triangulos,segundos,"
+                      "amostras_s,ns_triangulo\n");
+
+    numThreads = 1;
+    modoTesselacao = TESS_UNIFORME;
+    EscolheKernelSuperficie(KERNEL_AVX2);
+
+    for(r = 0; r < 6; r++)
+    {
+        if(r < 3)
+        {
+            if(!CarregaPontos((char*) arquivos[r]) || pc->n < 4) continue;
+            snprintf(nomeRede, sizeof(nomeRede), "%s", arquivos[r]);
+        }
+        else
+        {
+            RedeSintetica(sintN[r-3], sintM[r-3]);
+            snprintf(nomeRede, sizeof(nomeRede), "sintetica_%dx%d", pc->n, pc->m);
+        }
+
+        c.rede = nomeRede;
+        c.n = pc->n;
+        c.m = pc->m;
+
+        // MultMatriz nao depende da base nem de VARIA: 1000 chamadas por passo
+        c.base = "-";
+        c.varia = 0.0f;
+        c.amostras = 1000;
+        c.triangulos = 0;
+        registraBench(&s, &c, "MultMatriz", medeBench(passoMultMatriz, NULL));
+
+        for(b = 0; b < 3; b++)
+        {
+            MontaMatrizBase(bases[b]);
+            c.base = nomeBase[b];
+
+            // mesma conta com a matriz em tempo de execucao e especializada
+            c.varia = 0.0f;
+            c.triangulos = 0;
+            c.amostras = 1024;
+            registraBench(&s, &c, "curva_matriz", medeBench(passoCurva<-1>, NULL));
+            registraBench(&s, &c, "curva_especializada",
+                          medeBench(b == 1 ? passoCurva<SPLINE_BSPLINE> :
+                                    b == 2 ? passoCurva<SPLINE_CATMULLROM> : passoCurva<SPLINE_BEZIER>, NULL));
+            c.amostras = (long)(pc->n - 3) * (pc->m > 3 ? pc->m - 3 : 0);
+            registraBench(&s, &c, "coeficientes_matriz", medeBench(passoCoeficientes<-1>, NULL));
+            registraBench(&s, &c, "coeficientes_especializados",
+                          medeBench(b == 1 ? passoCoeficientes<SPLINE_BSPLINE> :
+                                    b == 2 ? passoCoeficientes<SPLINE_CATMULLROM> : passoCoeficientes<SPLINE_BEZIER>, NULL));
+            c.amostras = (long)(pc->n - 3) * pc->m;
+            registraBench(&s, &c, "conversao_bezier", medeBench(passoConversao, &cacheSup));
+
+            for(v = 0; v < 4; v++)
+            {
+                // no maximo ~4M vertices por caso
+                seg = (int)(1.0f / varias[v] + 0.5f);
+                if((double)(pc->n - 3) * pc->m * (seg + 1) * (seg + 1) > 4e6) continue;
+
+                VARIA = varias[v];
+                c.varia = VARIA;
+
+                modoAvaliacao = AVAL_MATRIZ;
+                AtualizaCache(&cacheSup);
+                c.amostras = cacheSup.sup.nVert;
+                c.triangulos = cacheSup.sup.nTri;
+
+                registraBench(&s, &c, "tesselacao", medeBench(passoTesselacao, &cacheSup));
+
+                modoAvaliacao = AVAL_DIFERENCAS;
+                registraBench(&s, &c, "tesselacao_diferencas", medeBench(passoTesselacao, &cacheSup));
+                modoAvaliacao = AVAL_MATRIZ;
+                AtualizaCache(&cacheSup);
+
+                // ptsSuperficie por patch (sem soldar), com e sem normais
+                c.amostras = (long)(pc->n - 3) * pc->m * tabPesos.n * tabPesos.n;
+                registraBench(&s, &c, "ptsSuperficie", medeBench(passoPtsSuperficie, NULL));
+                registraBench(&s, &c, "ptsSuperficie_normal", medeBench(passoPtsSuperficie, &c));
+
+                c.amostras = cacheSup.sup.nTri;
+                registraBench(&s, &c, "calcNormalTri", medeBench(passoNormalTri, &cacheSup.sup));
+
+                c.amostras = (long) cacheSup.sup.nVert * nLuzes;
+                registraBench(&s, &c, "luzContrib", medeBench(passoLuzContrib, &cacheSup.sup));
+
+                c.amostras = cacheSup.sup.nVert;
+                registraBench(&s, &c, "iluminacao", medeBench(passoIluminacao, &cacheSup.sup));
+
+                // quadro 4K na CPU: amostras sao pixels; em uma thread e
+                // em todos os nucleos
+                c.amostras = 3840L * 2160;
+                registraBench(&s, &c, "rasterizacao_4k", medeBench(passoRasterizacao, &cacheSup.sup));
+                numThreads = 0;
+                registraBench(&s, &c, "rasterizacao_4k_paralela", medeBench(passoRasterizacao, &cacheSup.sup));
+                numThreads = 1;
+
+                // uma edicao por passo; em redes pequenas cai na reavaliacao inteira
+                c.amostras = 1;
+                registraBench(&s, &c, "edicao_ponto", medeBench(passoEdicao, NULL));
+
+                // LOD de tela (janela de 700 pixels) com o objeto na escala
+                // em que foi carregado e visto de longe (1/8)
+                modoTesselacao = TESS_TELA;
+                for(z = 0; z < 2; z++)
+                {
+                    ModeloIdentidade();
+                    if(z) for(a = 0; a < 3; a++) matModelo[a][a] = 0.125f;
+                    AtualizaCache(&cacheSup);
+                    c.amostras = cacheSup.sup.nVert;
+                    c.triangulos = cacheSup.sup.nTri;
+                    registraBench(&s, &c, z ? "tesselacao_lod_longe" : "tesselacao_lod",
+                                  medeBench(passoTesselacao, &cacheSup));
+                }
+                ModeloIdentidade();
+                modoTesselacao = TESS_UNIFORME;
+            }
+        }
+    }
+
+    if(json) fprintf(s.f, "\n]\n");
+    fclose(s.f);
+
+    printf("%d registros gravados em %s\n", s.registros, arquivo);
+
+    VARIA = 0.04f;
+    ModeloIdentidade();
+    return 0;
+}
+
+// ---- modo em lote (-lote): tesselacao sem janela nem contexto OpenGL ----
+
+#define OBJ_BLOCO 4096   // vertices ou triangulos formatados por tarefa
+#define OBJ_FALHOU ((size_t) -1)
+
+// o texto do OBJ e formatado em blocos, em paralelo, e gravado em ordem.
+// Os blocos [0, nBlocosV) sao dos vertices vIni..vFim-1, os demais dos
+// triangulos a partir de tIni; o vertice v da malha e o desloc+v+1 do
+// arquivo. Um bloco sem memoria fica com tam = OBJ_FALHOU.
+typedef struct st_textoObj
+{
+    malha *sup;
+    int vIni, vFim, tIni;
+    long long desloc;
+    int nBlocosV, nBlocos;
+    char **texto;
+    size_t *tam;
+} textoObj;
+
+static void formataBlocoObj(int k, void *arg)
+{
+    textoObj *o = (textoObj*) arg;
+    malha *sup = o->sup;
+    int i, ini, fim;
+    size_t t = 0;
+    char *buf;
+    unsigned int *tri;
+
+    if(k < o->nBlocosV)
+    {
+        ini = o->vIni + k * OBJ_BLOCO;
+        fim = ini + OBJ_BLOCO < o->vFim ? ini + OBJ_BLOCO : o->vFim;
+        if((buf = (char*) malloc((size_t)(fim - ini) * 2 * 64)) == NULL) t = OBJ_FALHOU;
+        for(i = ini; buf && i < fim; i++)
+            t += sprintf(buf + t, "v %.6g %.6g %.6g\nvn %.5f %.5f %.5f\n",
+                         sup->vert[i][X], sup->vert[i][Y], sup->vert[i][Z],
+                         sup->normal[i][X], sup->normal[i][Y], sup->normal[i][Z]);
+    }
+    else
+    {
+        ini = o->tIni + (k - o->nBlocosV) * OBJ_BLOCO;
+        fim = ini + OBJ_BLOCO < sup->nTri ? ini + OBJ_BLOCO : sup->nTri;
+        if((buf = (char*) malloc((size_t)(fim - ini) * 128)) == NULL) t = OBJ_FALHOU;
+        for(i = ini; buf && i < fim; i++)
+        {
+            // indices do OBJ comecam em 1
+            tri = &sup->tri[3*i];
+            t += sprintf(buf + t, "f %lld//%lld %lld//%lld %lld//%lld\n", o->desloc + tri[0] + 1, o->desloc + tri[0] + 1,
+                         o->desloc + tri[1] + 1, o->desloc + tri[1] + 1,
+                         o->desloc + tri[2] + 1, o->desloc + tri[2] + 1);
+        }
+    }
+
+    if(!buf) printf("\n Error en alocacion de memoria para o texto do OBJ");
+    o->texto[k] = buf;
+    o->tam[k] = t;
+}
+
+// devolve 0 se faltar memoria para a lista de blocos
+static int FormataObj(textoObj *o, malha *sup, int vIni, int vFim, int tIni, long long desloc)
+{
+    o->sup = sup;
+    o->vIni = vIni;
+    o->vFim = vFim;
+    o->tIni = tIni;
+    o->desloc = desloc;
+    o->nBlocosV = (vFim - vIni + OBJ_BLOCO - 1) / OBJ_BLOCO;
+    o->nBlocos = o->nBlocosV + (sup->nTri - tIni + OBJ_BLOCO - 1) / OBJ_BLOCO;
+    o->texto = (char**) malloc(o->nBlocos * sizeof(char*));
+    o->tam = (size_t*) malloc(o->nBlocos * sizeof(size_t));
+    if(!o->texto || !o->tam)
+    {
+        printf("\n Error en alocacion de memoria para o texto do OBJ");
+        free(o->texto);
+        free(o->tam);
+        return 0;
+    }
+    paraleloPara(o->nBlocos, formataBlocoObj, o);
+    return 1;
+}
+
+// grava e libera os blocos [ini, fim) de o; devolve 0 se algum bloco
+// ficou sem memoria (e nao foi gravado)
+static int GravaBlocosObj(FILE *f, textoObj *o, int ini, int fim)
+{
+    int k, ok = 1;
+
+    for(k = ini; k < fim; k++)
+    {
+        if(o->tam[k] == OBJ_FALHOU) ok = 0;
+        else fwrite(o->texto[k], 1, o->tam[k], f);
+        free(o->texto[k]);
+    }
+    if(fim == o->nBlocos)
+    {
+        free(o->texto);
+        free(o->tam);
+    }
+    return ok;
+}
+
+// grava a malha como Wavefront OBJ (v, vn e f com o mesmo indice)
+int GravaMalhaObj(malha *sup, const char *arq, const char *origem, const char *base)
+{
+    FILE *f;
+    textoObj o;
+    int ok;
+
+    if((f = fopen(arq, "wb")) == NULL)
+    {
+        printf("Erro ao criar o arquivo %s \n", arq);
+        return 0;
+    }
 
-   // Desenhar indicadores das luzes (pequenas esferas coloridas)
-   glPushMatrix();
-     glTranslatef(lightPos1[X], lightPos1[Y], lightPos1[Z]);
-     glColor3f(1.0f, 0.9f, 0.7f);
-     glutSolidSphere(0.3f, 10, 10);
-   glPopMatrix();
+    fprintf(f, "# superficieTriangulada: %s, base %s\n# %d vertices, %d triangulos\n",
+            origem, base, sup->nVert, sup->nTri);
 
-   glPushMatrix();
-     glTranslatef(lightPos2[X], lightPos2[Y], lightPos2[Z]);
-     glColor3f(0.7f, 0.8f, 1.0f);
-     glutSolidSphere(0.25f, 8, 8);
-   glPopMatrix();
+    ok = FormataObj(&o, sup, 0, sup->nVert, 0, 0) && GravaBlocosObj(f, &o, 0, o.nBlocos);
 
-   glPopMatrix();
+    if(ferror(f)) ok = 0;
+    if(fclose(f) != 0) ok = 0;
+    if(!ok) remove(arq);   // nao deixa um OBJ pela metade
+    return ok;
+}
 
-   glutSwapBuffers();
+// nome de saida: o do arquivo de entrada com ext (".obj", ".png", ...) no
+// lugar da extensao, dentro de dir (se dado)
+static void NomeSaida(const char *entrada, const char *dir, const char *ext, char *saida, size_t tam)
+{
+    const char *nome, *barra;
+    char *ponto;
+
+    nome = entrada;
+    if(dir)
+    {
+        barra = strrchr(entrada, '/');
+        if(barra) nome = barra + 1;
+#ifdef _WIN32
+        barra = strrchr(nome, '\\');
+        if(barra) nome = barra + 1;
+#endif
+        snprintf(saida, tam, "%s/%s", dir, nome);
+    }
+    else
+        snprintf(saida, tam, "%s", nome);
+
+    ponto = strrchr(saida, '.');
+    if(ponto && !strchr(ponto, '/')) *ponto = '\0';
+    strncat(saida, ext, tam - strlen(saida) - 1);
 }
 
+// ---- fluxo (-lote -memoria MB): redes maiores que a memoria ----
+// A rede e lida por uma janela de tamanho fixo, em faixas de linhas de
+// pontos de controle, e cada faixa e tesselada e gravada no OBJ antes da
+// proxima ser lida. Os patches de uma faixa precisam de 3 linhas da rede
+// alem das suas, e cada faixa refaz tambem a ultima linha de patches da
+// anterior (sem grava-la), para que a costura entre as duas tenha os
+// mesmos vertices e normais da malha inteira (as normais degeneradas sao
+// medias dos triangulos dos dois lados). A linha de vertices da costura e
+// gravada pela faixa de baixo, e os triangulos de cada faixa depois dos
+// vertices da seguinte. O cabecalho e outro e os vertices (v/vn) se
+// intercalam com os triangulos (f) faixa a faixa, mas cada tipo de registro
+// sai na mesma sequencia do OBJ da malha inteira.
+
+#define JANELA_FLUXO (1 << 22)    // bytes do buffer de leitura
+#define MARGEM_FLUXO 4096         // bytes garantidos a frente de cada ponto
+#define BYTES_VERTICE_FLUXO 512   // estimativa: malha e texto do OBJ por vertice
+
+typedef struct st_fluxoPontos
+{
+    FILE *f;
+    char *buf;
+    int fimArq;
+    leitor l;
+} fluxoPontos;
+
+// move o que falta ler para o inicio do buffer e completa com o arquivo
+static void recarregaFluxo(fluxoPontos *fl)
+{
+    leitor *l = &fl->l;
+    size_t resto, pedido, lidos;
+
+    resto = l->fim - l->p;
+    memmove(fl->buf, l->p, resto);
+    pedido = JANELA_FLUXO - resto;
+    lidos = fread(fl->buf + resto, 1, pedido, fl->f);
+    if(lidos < pedido) fl->fimArq = 1;
+
+    // a coluna das mensagens de erro passa a contar do inicio do buffer
+    l->inicioLinha = fl->buf;
+    l->p = fl->buf;
+    l->fim = fl->buf + resto + lidos;
+}
 
-void reshape(int w, int h)
+// garante MARGEM_FLUXO bytes a frente do proximo token (ou o fim do arquivo)
+static void preparaFluxo(fluxoPontos *fl)
 {
-   glViewport(0, 0, (GLsizei) w, (GLsizei) h);
-   glMatrixMode(GL_PROJECTION);
-   glLoadIdentity();
-   if (w <= h)
-      glOrtho(-10.0, 10.0, -10.0*(GLfloat)h/(GLfloat)w,
-              10.0*(GLfloat)h/(GLfloat)w, -10.0, 30.0);
-   else
-      glOrtho(-10.0*(GLfloat)w/(GLfloat)h,
-              10.0*(GLfloat)w/(GLfloat)h, -10.0, 10.0, -10.0, 30.0);
-   glMatrixMode(GL_MODELVIEW);
+    for(;;)
+    {
+        if(fl->l.fim - fl->l.p >= MARGEM_FLUXO || fl->fimArq) return;
+        recarregaFluxo(fl);
+        if(pulaBrancos(&fl->l) && fl->l.fim - fl->l.p >= MARGEM_FLUXO) return;
+    }
 }
 
-void keyboard(int key, int x, int y)
+static int AbreFluxo(const char *arq, fluxoPontos *fl, int *n, int *m)
 {
-    int i,j;
-    MatrizIdentidade();
-    switch(comando)
-    {   case Redimensionar:
-            switch (key)
-            {   case GLUT_KEY_LEFT:
-                    AuxVertex[0][0] = 0.95;
-                    AuxVertex[1][1] = 0.95;
-                    AuxVertex[2][2] = 0.95;
-                    break;
-                case GLUT_KEY_RIGHT:
-                    AuxVertex[0][0] = 1.05;
-                    AuxVertex[1][1] = 1.05;
-                    AuxVertex[2][2] = 1.05;
-                    break;
-                case GLUT_KEY_UP:
-                    AuxVertex[0][0] = 1.05;
-                    AuxVertex[1][1] = 1.05;
-                    AuxVertex[2][2] = 1.05;
-                    break;
-                case GLUT_KEY_DOWN:
-                    AuxVertex[0][0] = 0.95;
-                    AuxVertex[1][1] = 0.95;
-                    AuxVertex[2][2] = 0.95;
-                    break;
-            }
-            break;
+    if((fl->f = fopen(arq, "rb")) == NULL)
+    {
+        printf("Error en la apertura del archivo %s \n", arq);
+        return 0;
+    }
+    if((fl->buf = (char*) malloc(JANELA_FLUXO)) == NULL)
+    {
+        printf("\n Error en alocacion de memoria para a janela de leitura");
+        fclose(fl->f);
+        fl->f = NULL;
+        return 0;
+    }
+    fl->fimArq = 0;
+    fl->l.p = fl->l.fim = fl->l.inicioLinha = fl->buf;
+    fl->l.linha = 1;
+    fl->l.arq = arq;
 
-        case GirarX:
-            switch (key)
-            {   case GLUT_KEY_LEFT:
-                    AuxVertex[1][1] = cos(-0.01);
-                    AuxVertex[1][2] = sin(-0.01);
-                    AuxVertex[2][1] = -sin(-0.01);
-                    AuxVertex[2][2] = cos(-0.01);
-                    break;
-                case GLUT_KEY_RIGHT:
-                    AuxVertex[1][1] = cos(0.01);
-                    AuxVertex[1][2] = sin(0.01);
-                    AuxVertex[2][1] = -sin(0.01);
-                    AuxVertex[2][2] = cos(0.01);
-                    break;
-                case GLUT_KEY_UP:
-                    AuxVertex[1][1] = cos(0.01);
-                    AuxVertex[1][2] = sin(0.01);
-                    AuxVertex[2][1] = -sin(0.01);
-                    AuxVertex[2][2] = cos(0.01);
-                    break;
-                case GLUT_KEY_DOWN:
-                    AuxVertex[1][1] = cos(-0.01);
-                    AuxVertex[1][2] = sin(-0.01);
-                    AuxVertex[2][1] = -sin(-0.01);
-                    AuxVertex[2][2] = cos(-0.01);
-                    break;
-            }
-            break;
-        case GirarY:
-            switch (key)
-            {   case GLUT_KEY_LEFT:
-                    AuxVertex[0][0] = cos(-0.01);
-                    AuxVertex[0][2] = -sin(-0.01);
-                    AuxVertex[2][0] = sin(-0.01);
-                    AuxVertex[2][2] = cos(-0.01);
-                    break;
-                case GLUT_KEY_RIGHT:
-                    AuxVertex[0][0] = cos(0.01);
-                    AuxVertex[0][2] = -sin(0.01);
-                    AuxVertex[2][0] = sin(0.01);
-                    AuxVertex[2][2] = cos(0.01);
-                    break;
-                case GLUT_KEY_UP:
-                    AuxVertex[0][0] = cos(0.01);
-                    AuxVertex[0][2] = -sin(0.01);
-                    AuxVertex[2][0] = sin(0.01);
-                    AuxVertex[2][2] = cos(0.01);
-                    break;
-                case GLUT_KEY_DOWN:
-                    AuxVertex[0][0] = cos(-0.01);
-                    AuxVertex[0][2] = -sin(-0.01);
-                    AuxVertex[2][0] = sin(-0.01);
-                    AuxVertex[2][2] = cos(-0.01);
-                    break;
-            }
-            break;
-        case GirarZ:
-            switch (key)
-            {   case GLUT_KEY_LEFT:
-                    AuxVertex[0][0] = cos(-0.01);
-                    AuxVertex[0][1] = sin(-0.01);
-                    AuxVertex[1][0] = -sin(-0.01);
-                    AuxVertex[1][1] = cos(-0.01);
-                    MultMatriz();
-                    break;
-                case GLUT_KEY_RIGHT:
-                    AuxVertex[0][0] = cos(0.01);
-                    AuxVertex[0][1] = sin(0.01);
-                    AuxVertex[1][0] = -sin(0.01);
-                    AuxVertex[1][1] = cos(0.01);
-                    MultMatriz();
-                    break;
-                case GLUT_KEY_UP:
-                    AuxVertex[0][0] = cos(0.01);
-                    AuxVertex[0][1] = sin(0.01);
-                    AuxVertex[1][0] = -sin(0.01);
-                    AuxVertex[1][1] = cos(0.01);
-                    MultMatriz();
-                    break;
-                case GLUT_KEY_DOWN:
-                    AuxVertex[0][0] = cos(-0.01);
-                    AuxVertex[0][1] = sin(-0.01);
-                    AuxVertex[1][0] = -sin(-0.01);
-                    AuxVertex[1][1] = cos(-0.01);
-                    MultMatriz();
-                    break;
-            }
-            break;
+    preparaFluxo(fl);
+    return LeCabecalho(&fl->l, n, m);
+}
 
-   }
-    MultMatriz();
-    glutPostRedisplay();
+static void FechaFluxo(fluxoPontos *fl)
+{
+    fclose(fl->f);
+    free(fl->buf);
 }
 
-int CarregaPontos( char *arch)
+// le as linhas [j0, j0+nLinhas) da rede n x m nas linhas [d0, ...) de dest
+static int LeLinhasFluxo(fluxoPontos *fl, int j0, int nLinhas, int n, int m, matriz *dest, int d0)
 {
-  FILE *fobj;
-  char token[40];
-  float px, py, pz;
-  int i, j, n, m;
+    int j, i;
 
-  printf(" \n ler  %s  \n", arch);
+    for(j = 0; j < nLinhas; j++)
+        for(i = 0; i < m; i++)
+        {
+            preparaFluxo(fl);
+            if(!LePonto(&fl->l, (long long)(j0 + j) * m + i, (long long) n * m, dest->ponto[d0 + j][i])) return 0;
+        }
+    return 1;
+}
 
-  if((fobj=fopen(arch,"rt"))==NULL)
-  {
-     printf("Error en la apertura del archivo %s \n", arch);
-     return 0;
-  }
+// tessela arq faixa a faixa, com no maximo ~memoria bytes de malha e
+// texto por faixa, gravando direto em saida
+int ProcessaFluxo(const char *arq, const char *saida, const char *base, size_t memoria)
+{
+    fluxoPontos fl;
+    arquivoMapeado semMapa;
+    textoObj o, pendente;
+    FILE *f;
+    int n, m, j, i, lidas, novas, repete, faixa, seg, vIni, vFim, tIni, temPendente, ok;
+    long long nTri = 0, gravados = 0;
+    double vertFaixa;
+    std::chrono::steady_clock::time_point t0;
+
+    t0 = std::chrono::steady_clock::now();
+
+    // a adaptativa escolhe os segmentos das colunas por faixa, e as
+    // costuras entre faixas nao coincidiriam
+    if(modoTesselacao == TESS_ADAPTATIVA)
+    {
+        printf("%s: -memoria usa a tesselacao uniforme\n", arq);
+        modoTesselacao = TESS_UNIFORME;
+    }
 
-  fgets(token, 40, fobj);
-  fscanf(fobj, "%s %d %d", token, &n, &m);
+    if(!AbreFluxo(arq, &fl, &n, &m))
+    {
+        if(fl.f) FechaFluxo(&fl);
+        return 0;
+    }
+    if(n < 4)
+    {
+        printf("%s: ignorado (sem patches para tesselar)\n", arq);
+        FechaFluxo(&fl);
+        return 0;
+    }
 
-  if (pc) pc = liberaMatriz(pc);
+    // linhas de patches por faixa pela estimativa de vertices de uma linha
+    if(!AtualizaTabelaPesos(&tabPesos))
+    {
+        FechaFluxo(&fl);
+        return 0;
+    }
+    seg = tabPesos.n;
+    vertFaixa = (double) seg * seg * m;
+    faixa = (int)(memoria / (vertFaixa * BYTES_VERTICE_FLUXO));
+    if(faixa < 1) faixa = 1;
+    if(faixa > n - 3) faixa = n - 3;
+    if(faixa < n - 3 && faixa < 2) faixa = 2;   // cada faixa refaz uma linha da anterior
+
+    if((f = fopen(saida, "wb")) == NULL)
+    {
+        printf("Erro ao criar o arquivo %s \n", saida);
+        FechaFluxo(&fl);
+        return 0;
+    }
+    fprintf(f, "# superficieTriangulada: %s, base %s, faixas de %d linhas de patches\n", arq, base, faixa);
 
-  pc=AlocaMatriz(n,m);
+    // a primeira faixa le as 3 linhas a mais que os patches precisam; as
+    // outras comecam pelas 4 ultimas da anterior (uma linha de patches)
+    if(pcNovo) ok = RedimensionaMatriz(pcNovo, faixa + 3, m);
+    else ok = (pcNovo = AlocaRede(faixa + 3, m)) != NULL;
+    ok = ok && LeLinhasFluxo(&fl, 0, 3, n, m, pcNovo, 0);
 
-  for(j=0; j<pc->n; j++)
-  {
-    for(i=0; i<pc->m; i++)
-     {
-         fscanf(fobj, "%s %f %f %f", token, &px, &py, &pz);
+    semMapa.tam = 0;
+    temPendente = 0;
+    for(lidas = 3; ok && lidas < n; lidas += novas)
+    {
+        repete = lidas == 3 ? 3 : 4;
+        novas = faixa + 3 - repete;
+        if(novas > n - lidas) novas = n - lidas;
 
-         pc->ponto[j][i][0] = px * local_scale;
-         pc->ponto[j][i][1] = py * local_scale;
-         pc->ponto[j][i][2] = pz * local_scale;
-         pc->ponto[j][i][3] = 0.0f;
-     }
-  }
+        if(repete == 4)
+        {
+            if(pcNovo) ok = RedimensionaMatriz(pcNovo, novas + 4, m);
+            else ok = (pcNovo = AlocaRede(novas + 4, m)) != NULL;
+            for(j = 0; ok && j < 4; j++)
+                for(i = 0; i < m; i++)
+                    memcpy(pcNovo->ponto[j][i], pc->ponto[pc->n - 4 + j][i], sizeof(f4d));
+        }
+        if(!ok || !(ok = LeLinhasFluxo(&fl, lidas, novas, n, m, pcNovo, repete))) break;
 
-  // espaco de matriz para um patch
-  if(pcPatch) pcPatch = liberaMatriz(pcPatch);
-  pcPatch = AlocaMatriz(4,4);
+        InstalaPc(pcNovo, &pcNovo, &semMapa);
+        AtualizaCache(&cacheSup);
+        if(!(ok = CacheValido(&cacheSup))) break;   // sem memoria para a faixa
 
-  return 1;
+        // a linha de patches refeita da faixa anterior nao e gravada, nem a
+        // linha de vertices da costura de baixo, que a proxima faixa grava
+        vIni = tIni = 0;
+        if(repete == 4)
+        {
+            vIni = cacheSup.soldada ? cacheSup.segS[0] * cacheSup.colunasV : cacheSup.basePatch[cacheSup.nColunasPatch];
+            tIni = 2 * cacheSup.segS[0] * cacheSup.colunasV;
+        }
+        vFim = cacheSup.sup.nVert;
+        if(cacheSup.soldada && lidas + novas < n) vFim -= cacheSup.colunasV;
+
+        if(!(ok = FormataObj(&o, &cacheSup.sup, vIni, vFim, tIni, gravados - vIni))) break;
+        if(!GravaBlocosObj(f, &o, 0, o.nBlocosV)) ok = 0;
+        if(temPendente && !GravaBlocosObj(f, &pendente, pendente.nBlocosV, pendente.nBlocos)) ok = 0;
+        pendente = o;
+        temPendente = 1;
+
+        gravados += vFim - vIni;
+        nTri += cacheSup.sup.nTri - tIni;
+    }
+    if(temPendente && !GravaBlocosObj(f, &pendente, pendente.nBlocosV, pendente.nBlocos)) ok = 0;
+    FechaFluxo(&fl);
+
+    fprintf(f, "# %lld vertices, %lld triangulos\n", gravados, nTri);
+    ok = ok && !ferror(f);
+    if(fclose(f) != 0) ok = 0;
+    if(!ok) remove(saida);   // nao deixa um OBJ pela metade
+
+    if(ok) printf("%s -> %s: %lld vertices, %lld triangulos, faixas de %d linhas, %.1f ms\n", arq, saida,
+                  gravados, nTri, faixa,
+                  std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3);
+    return ok;
+}
+
+// opcoes de linha de comando seguidas de um valor, as de main() e as do
+// lote: o valor nao e um arquivo de entrada
+static int OpcaoComValor(const char *arg)
+{
+    const char *opcoes[] = {"-t", "-tol", "-lod", "-perfil", "-o", "-base", "-varia",
+                            "-saida", "-memoria", "-imagem", "-formato"};
+    unsigned k;
+
+    for(k = 0; k < sizeof(opcoes) / sizeof(opcoes[0]); k++)
+        if(strcmp(arg, opcoes[k]) == 0) return 1;
+    return 0;
+}
+
+// -lote [-base bezier|bspline|catmullrom] [-varia V] [-adaptativa]
+//       [-saida DIR] [-memoria MB] arq1.txt arq2.txt ...
+// Tessela cada arquivo e grava arqN.obj. Os arquivos nao sao processados
+// em paralelo, e sim um por vez, porque o estado da superficie (pc,
+// cacheSup, a base, VARIA) e global; o paralelismo fica dentro de cada
+// arquivo: a avaliacao dos patches e a formatacao do OBJ usam todos os
+// nucleos (ou -t N). Devolve o numero de arquivos que falharam. Com
+// -memoria cada arquivo e lido e gravado em faixas (ProcessaFluxo), sem
+// carregar a rede nem a malha inteiras.
+int ProcessaLote(int argc, char **argv)
+{
+    const char *nomeBase[] = {"bezier", "bspline", "catmullrom"};
+    int bases[] = {BEZIER, BSPLINE, CATMULLROM};
+    int i, b, base = 0, falhas = 0, total = 0;
+    const char *dir = NULL, *formato = ".png";
+    char saida[1024];
+    size_t memoria = 0;
+    int larg = 0, alt = 0;
+    const unsigned char *img;
+    double tRaster;
+    std::chrono::steady_clock::time_point t0, t1;
+
+    numThreads = 0;
+    modoTesselacao = TESS_UNIFORME;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-base") == 0 && i + 1 < argc)
+        {
+            i++;
+            for(b = 0; b < 3 && strcmp(argv[i], nomeBase[b]) != 0; b++);
+            if(b == 3)
+            {
+                printf("Base desconhecida: %s (use bezier, bspline ou catmullrom)\n", argv[i]);
+                return 1;
+            }
+            base = b;
+        }
+        else if(strcmp(argv[i], "-varia") == 0 && i + 1 < argc)
+            VARIA = (float) atof(argv[++i]);
+        else if(strcmp(argv[i], "-adaptativa") == 0)
+            modoTesselacao = TESS_ADAPTATIVA;
+        else if(strcmp(argv[i], "-saida") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            numThreads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-memoria") == 0 && i + 1 < argc)
+            memoria = (size_t)(atof(argv[++i]) * 1048576.0);
+        else if(strcmp(argv[i], "-imagem") == 0 && i + 1 < argc)
+        {
+            if(sscanf(argv[++i], "%dx%d", &larg, &alt) != 2 || larg <= 0 || alt <= 0)
+            {
+                printf("-imagem: use LARGURAxALTURA (por exemplo 3840x2160)\n");
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-formato") == 0 && i + 1 < argc)
+        {
+            i++;
+            if(strcmp(argv[i], "png") != 0 && strcmp(argv[i], "ppm") != 0)
+            {
+                printf("Formato desconhecido: %s (use png ou ppm)\n", argv[i]);
+                return 1;
+            }
+            formato = strcmp(argv[i], "png") == 0 ? ".png" : ".ppm";
+        }
+        else if(strcmp(argv[i], "-tol") == 0 && i + 1 < argc)
+            i++;   // ja tratado em main()
+    }
+
+    if(VARIA <= 0.0f || VARIA > 1.0f)
+    {
+        printf("VARIA deve estar em (0, 1]\n");
+        return 1;
+    }
+    if(larg && memoria)
+    {
+        printf("-imagem precisa da malha inteira e nao combina com -memoria\n");
+        return 1;
+    }
+
+    for(i = 1; i < argc; i++)
+    {
+        if(argv[i][0] == '-')
+        {
+            if(OpcaoComValor(argv[i])) i++;
+            continue;
+        }
+
+        total++;
+        if(memoria)
+        {
+            MontaMatrizBase(bases[base]);
+            NomeSaida(argv[i], dir, ".obj", saida, sizeof(saida));
+            if(!ProcessaFluxo(argv[i], saida, nomeBase[base], memoria)) falhas++;
+            continue;
+        }
+
+        t0 = std::chrono::steady_clock::now();
+        if(!CarregaPontos(argv[i]) || pc->n < 4 || pc->m < 1)
+        {
+            printf("%s: ignorado (sem patches para tesselar)\n", argv[i]);
+            falhas++;
+            continue;
+        }
+
+        MontaMatrizBase(bases[base]);
+        if(!CacheValido(&cacheSup)) AtualizaCache(&cacheSup);   // pode vir do .stb
+        if(!CacheValido(&cacheSup))
+        {
+            printf("%s: ignorado (sem memoria para a malha)\n", argv[i]);
+            falhas++;
+            continue;
+        }
+
+        if(larg)
+        {
+            // imagem no lugar do OBJ, na vista inicial da janela
+            NomeSaida(argv[i], dir, formato, saida, sizeof(saida));
+            t1 = std::chrono::steady_clock::now();
+            img = RasterizaMalha(&cacheSup.sup, larg, alt);
+            tRaster = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count() * 1e3;
+            if(!img || !imagemGrava(saida, img, larg, alt))
+            {
+                falhas++;
+                continue;
+            }
+            printf("%s -> %s: %dx%d, %d triangulos, %.1f ms (rasterizacao %.1f ms)\n", argv[i], saida,
+                   larg, alt, cacheSup.sup.nTri,
+                   std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3, tRaster);
+            continue;
+        }
+
+        NomeSaida(argv[i], dir, ".obj", saida, sizeof(saida));
+        if(!GravaMalhaObj(&cacheSup.sup, saida, argv[i], nomeBase[base]))
+        {
+            falhas++;
+            continue;
+        }
+
+        printf("%s -> %s: %d vertices, %d triangulos, %.1f ms\n", argv[i], saida,
+               cacheSup.sup.nVert, cacheSup.sup.nTri,
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3);
+    }
+
+    if(total == 0) printf("-lote: nenhum arquivo de pontos de controle\n");
+    return falhas || total == 0;
 }
 
 void processMenuEvents(int option)
@@ -747,6 +4922,29 @@ void processMenuEvents(int option)
         tipoView = GL_TRIANGLES; // exibimos triângulos
     else if (option == sair)
         exit (0);
+    else if (option == AVAL_MATRIZ || option == AVAL_DIFERENCAS)
+        modoAvaliacao = option;
+    else if (option == TESS_UNIFORME || option == TESS_ADAPTATIVA || option == TESS_TELA)
+        modoTesselacao = option;
+    else if (option == PERFIL_OVERLAY)
+    {
+        perfilOverlay = !perfilOverlay;
+        perfilAtivo = perfilOverlay || arqPerfil;
+    }
+    else if (option == SALVAR_IMAGEM)
+    {
+        // a malha da vista atual, sem a rede de controle nem as luzes
+        int w = glutGet(GLUT_WINDOW_WIDTH), h = glutGet(GLUT_WINDOW_HEIGHT);
+        const unsigned char *img = CacheValido(&cacheSup) ? RasterizaMalha(&cacheSup.sup, w, h) : NULL;
+
+        if(img && imagemGrava("superficie.png", img, w, h))
+            printf(" superficie.png: %dx%d, %d triangulos\n", w, h, cacheSup.sup.nTri);
+    }
+    else if (option >= THREADS_1 && option <= THREADS_TODAS)
+    {
+        int n[] = {1, 2, 4, 8, 0};
+        numThreads = n[option - THREADS_1];
+    }
     else
         comando = option;
 
@@ -759,7 +4957,8 @@ void processMenuEvents(int option)
 
 void createGLUTMenus()
 {
-    int menu, submenu, SUBmenuGirar,SUBmenuSuperficie,SUBmenuPintar, SUBmenuObjetos;
+    int menu, submenu, SUBmenuGirar,SUBmenuSuperficie,SUBmenuPintar, SUBmenuObjetos, SUBmenuThreads,
+        SUBmenuAvaliacao, SUBmenuTesselacao;
 
     SUBmenuSuperficie = glutCreateMenu(processMenuEvents);
     glutAddMenuEntry("Bezier", BEZIER);
@@ -781,6 +4980,22 @@ void createGLUTMenus()
     glutAddMenuEntry("Cubo", OBJ_CUBO);
     glutAddMenuEntry("Esfera", OBJ_ESFERA);
 
+    SUBmenuAvaliacao = glutCreateMenu(processMenuEvents);
+    glutAddMenuEntry("Matricial (S G P G^t T)", AVAL_MATRIZ);
+    glutAddMenuEntry("Diferencas progressivas", AVAL_DIFERENCAS);
+
+    SUBmenuTesselacao = glutCreateMenu(processMenuEvents);
+    glutAddMenuEntry("Uniforme (VARIA)", TESS_UNIFORME);
+    glutAddMenuEntry("Adaptativa (erro de corda)", TESS_ADAPTATIVA);
+    glutAddMenuEntry("Nivel de detalhe pela tela (LOD)", TESS_TELA);
+
+    SUBmenuThreads = glutCreateMenu(processMenuEvents);
+    glutAddMenuEntry("1", THREADS_1);
+    glutAddMenuEntry("2", THREADS_2);
+    glutAddMenuEntry("4", THREADS_4);
+    glutAddMenuEntry("8", THREADS_8);
+    glutAddMenuEntry("Todos os nucleos", THREADS_TODAS);
+
     menu = glutCreateMenu(processMenuEvents);
     glutAddMenuEntry("Carregar pontos de controle (padrao)", PtsControle);
     glutAddSubMenu("Tipo de Superficie",SUBmenuSuperficie);
@@ -788,14 +5003,71 @@ void createGLUTMenus()
     glutAddSubMenu("Objet View",SUBmenuPintar);
     glutAddMenuEntry("Redimensionar",Redimensionar);
     glutAddSubMenu("Rotacionar",SUBmenuGirar);
+    glutAddMenuEntry("Editar ponto de controle", EditarPonto);
+    glutAddSubMenu("Avaliacao da superficie",SUBmenuAvaliacao);
+    glutAddSubMenu("Tesselacao",SUBmenuTesselacao);
+    glutAddSubMenu("Threads de tesselacao",SUBmenuThreads);
+    glutAddMenuEntry("Tempos por etapa (liga/desliga)", PERFIL_OVERLAY);
+    glutAddMenuEntry("Salvar imagem (CPU, superficie.png)", SALVAR_IMAGEM);
     glutAddMenuEntry("Sair",sair);
     glutAttachMenu(GLUT_RIGHT_BUTTON);
 }
 
 int main(int argc, char** argv)
 {
+   int i, json = 0;
+   const char *saidaBench = NULL;
+
+   // -bench: mede os avaliadores sem abrir janela (nao precisa de display)
+   // -lote: tessela arquivos e grava .obj, tambem sem janela
+   // -microbench [-json] [-o arq]: tempos de cada etapa em CSV/JSON
+   // -cache: usa/grava o cache binario .stb ao lado de cada arquivo lido
+   // -tol E: tolerancia de corda da tesselacao adaptativa
+   // -lod PX: pixels por segmento do LOD de tela
+   for(i = 1; i < argc; i++)
+   {
+       if(strcmp(argv[i], "-tol") == 0 && i + 1 < argc)
+           tolCorda = (float) atof(argv[++i]);
+       else if(strcmp(argv[i], "-lod") == 0 && i + 1 < argc)
+           pixelsSegmento = (float) atof(argv[++i]);
+       else if(strcmp(argv[i], "-cache") == 0)
+           usaCacheBin = 1;
+   }
+   for(i = 1; i < argc; i++)
+   {
+       if(strcmp(argv[i], "-bench") == 0)
+       {
+           BenchmarkAvaliadores();
+           return 0;
+       }
+       if(strcmp(argv[i], "-lote") == 0)
+           return ProcessaLote(argc, argv);
+       if(strcmp(argv[i], "-microbench") == 0)
+       {
+           for(i = 1; i < argc; i++)
+           {
+               if(strcmp(argv[i], "-json") == 0) json = 1;
+               else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) saidaBench = argv[++i];
+           }
+           if(!saidaBench) saidaBench = json ? "microbench.json" : "microbench.csv";
+           return MicroBenchmark(json, saidaBench);
+       }
+   }
+
    glutInit(&argc, argv);
 
+   // -t N: threads para tesselar os patches (0 = todos os nucleos)
+   // -perfil arq.csv|arq.json: grava os tempos de cada quadro
+   for(i = 1; i < argc; i++)
+   {
+       if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+           numThreads = atoi(argv[++i]);
+       else if(strcmp(argv[i], "-perfil") == 0 && i + 1 < argc)
+       {
+           if(!AbreArquivoPerfil(argv[++i])) return 1;
+       }
+   }
+
    glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
    glutInitWindowSize(700, 700);
    glutCreateWindow("Superficies - Trianguladas");
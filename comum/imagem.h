@@ -0,0 +1,498 @@
+/* imagem.h
+   Rasterizacao de triangulos em CPU e gravacao de imagens RGB (PPM e
+   PNG sem zlib), sem OpenGL nem display. So cabecalho, em C e em C++.
+
+   O rasterizador recebe os vertices ja na janela: a posicao em 1/16 de
+   pixel (rasterPosicao), a profundidade de -1 (perto) a 1 (longe) e a
+   iluminacao de cada um, e os triangulos com o indice da cor de cada um.
+   A cor de um vertice e a iluminacao vezes a cor do triangulo (limitada
+   a 1, como no OpenGL), interpolada no triangulo, com teste de
+   profundidade. A imagem e dividida em blocos de RASTER_BLOCO x
+   RASTER_BLOCO pixels. Os triangulos sao distribuidos pelos blocos que a
+   caixa deles toca, na ordem dada, e cada bloco e desenhado inteiro por
+   uma tarefa, com a sua profundidade. As arestas sao avaliadas em
+   inteiros (regra topo-esquerda), entao triangulos vizinhos nao deixam
+   furos nem pintam o mesmo pixel duas vezes, e a imagem nao depende do
+   numero de threads.
+
+   Uso: rasterBlocos; o chamador reserva contagem, inicio e imagem;
+   rasterConta devolve o tamanho de lista; o chamador a reserva;
+   rasterDesenha. As tarefas vao para r->paralelo (ou rodam em serie se
+   for NULL).
+*/
+
+#ifndef IMAGEM_H
+#define IMAGEM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+
+#define RASTER_BLOCO   64        /* lado de um bloco da tela (pixels) */
+#define RASTER_SUB     4         /* bits de subpixel */
+#define RASTER_GUARDA  (1 << 19) /* |coordenada| maxima (pixels) de um vertice */
+#define RASTER_FORA    INT_MIN   /* vertice fora da faixa de guarda */
+#define RASTER_GRUPOS  64        /* grupos de triangulos na distribuicao */
+
+typedef struct st_rasterImagem
+{
+    int larg, alt;
+    int blocosX, blocosY, nBlocos;
+    int nTri;
+    const unsigned int *tri;      /* 3 vertices por triangulo */
+    const unsigned char *corTri;  /* indice em cores de cada triangulo */
+    const float (*cores)[4];      /* r, g, b */
+    int *xy;               /* posicao de cada vertice em 1/16 de pixel */
+    float *z;              /* profundidade normalizada (-1 perto, 1 longe) */
+    float *luz;
+    size_t *contagem;      /* [grupo][bloco]: triangulos, depois posicao na lista */
+    size_t *inicio;        /* triangulos do bloco b: lista[inicio[b], inicio[b+1]) */
+    int *lista;
+    unsigned char *imagem; /* RGB, linha 0 em cima */
+    void (*paralelo)(int n, void (*tarefa)(int k, void *arg), void *arg);
+} rasterImagem;
+
+static inline void rasterTarefas(rasterImagem *r, int n, void (*tarefa)(int, void*))
+{
+    int k;
+
+    if(r->paralelo) r->paralelo(n, tarefa, r);
+    else for(k = 0; k < n; k++) tarefa(k, r);
+}
+
+/* posicao (x, y) da janela, em pixels, em 1/16 de pixel; fora da faixa de
+   guarda (ou NaN) fica RASTER_FORA */
+static inline void rasterPosicao(double x, double y, int xy[2])
+{
+    if(fabs(x) < RASTER_GUARDA && fabs(y) < RASTER_GUARDA)
+    {
+        xy[0] = (int) lrint(x * (1 << RASTER_SUB));
+        xy[1] = (int) lrint(y * (1 << RASTER_SUB));
+    }
+    else
+        xy[0] = RASTER_FORA;
+}
+
+/* tamanhos: contagem com RASTER_GRUPOS * nBlocos, inicio com nBlocos + 1
+   e imagem com larg * alt * 3 */
+static inline void rasterBlocos(rasterImagem *r, int larg, int alt)
+{
+    r->larg = larg;
+    r->alt = alt;
+    r->blocosX = (larg + RASTER_BLOCO - 1) / RASTER_BLOCO;
+    r->blocosY = (alt + RASTER_BLOCO - 1) / RASTER_BLOCO;
+    r->nBlocos = r->blocosX * r->blocosY;
+}
+
+/* pixels cujo centro pode cair no triangulo t, recortados a imagem:
+   caixa = x0, y0, x1, y1 (inclusive). 0 se nenhum. */
+static inline int rasterCaixa(const rasterImagem *r, int t, int caixa[4])
+{
+    const unsigned int *tri = &r->tri[3*t];
+    const int *a = &r->xy[2*tri[0]], *b = &r->xy[2*tri[1]], *c = &r->xy[2*tri[2]];
+    int lo, hi, meio = 1 << (RASTER_SUB - 1);
+    float za = r->z[tri[0]], zb = r->z[tri[1]], zc = r->z[tri[2]];
+
+    if(a[0] == RASTER_FORA || b[0] == RASTER_FORA || c[0] == RASTER_FORA) return 0;
+    if((za > 1.0f && zb > 1.0f && zc > 1.0f) || (za < -1.0f && zb < -1.0f && zc < -1.0f)) return 0;
+
+    /* o centro do pixel i esta em 16 i + 8 */
+    lo = a[0] < b[0] ? a[0] : b[0];  if(c[0] < lo) lo = c[0];
+    hi = a[0] > b[0] ? a[0] : b[0];  if(c[0] > hi) hi = c[0];
+    caixa[0] = (lo - meio + (1 << RASTER_SUB) - 1) >> RASTER_SUB;
+    caixa[2] = (hi - meio) >> RASTER_SUB;
+    lo = a[1] < b[1] ? a[1] : b[1];  if(c[1] < lo) lo = c[1];
+    hi = a[1] > b[1] ? a[1] : b[1];  if(c[1] > hi) hi = c[1];
+    caixa[1] = (lo - meio + (1 << RASTER_SUB) - 1) >> RASTER_SUB;
+    caixa[3] = (hi - meio) >> RASTER_SUB;
+
+    if(caixa[0] < 0) caixa[0] = 0;
+    if(caixa[1] < 0) caixa[1] = 0;
+    if(caixa[2] >= r->larg) caixa[2] = r->larg - 1;
+    if(caixa[3] >= r->alt) caixa[3] = r->alt - 1;
+    return caixa[0] <= caixa[2] && caixa[1] <= caixa[3];
+}
+
+/* as duas passadas da distribuicao: conta os triangulos do grupo g em
+   cada bloco e depois escreve os indices nas posicoes ja somadas */
+static inline void rasterDistribuiGrupo(int g, void *arg, int escreve)
+{
+    rasterImagem *r = (rasterImagem*) arg;
+    int t, t0, t1, bx, by, caixa[4];
+    size_t *cont = r->contagem + (size_t) g * r->nBlocos;
+
+    t0 = (int)((long long) r->nTri * g / RASTER_GRUPOS);
+    t1 = (int)((long long) r->nTri * (g + 1) / RASTER_GRUPOS);
+
+    for(t = t0; t < t1; t++)
+    {
+        if(!rasterCaixa(r, t, caixa)) continue;
+        for(by = caixa[1] / RASTER_BLOCO; by <= caixa[3] / RASTER_BLOCO; by++)
+            for(bx = caixa[0] / RASTER_BLOCO; bx <= caixa[2] / RASTER_BLOCO; bx++)
+            {
+                if(escreve) r->lista[cont[by * r->blocosX + bx]++] = t;
+                else cont[by * r->blocosX + bx]++;
+            }
+    }
+}
+
+static inline void rasterContaGrupo(int g, void *arg)    { rasterDistribuiGrupo(g, arg, 0); }
+static inline void rasterEscreveGrupo(int g, void *arg)  { rasterDistribuiGrupo(g, arg, 1); }
+
+/* desenha o triangulo t nos pixels [x0, x1] x [y0, y1] de um bloco com
+   profundidade prof (RASTER_BLOCO por linha, a partir de x0, y0) */
+static inline void rasterTriangulo(const rasterImagem *r, int t, int x0, int y0, int x1, int y1, float *prof)
+{
+    const unsigned int *tri = &r->tri[3*t];
+    const int *p[3];
+    const float *cor = r->cores[r->corTri[t]];
+    int v, b, caixa[4], ix, iy, px, py, ordem[3], planos = 0;
+    long long area, e[3], eLinha[3], passoX[3], passoY[3], vies[3];
+    float atr[3][4], dx1, dy1, dx2, dy2, inv, ddx[4], ddy[4], base[4], z;
+    unsigned char *pix;
+    float *d;
+
+    if(!rasterCaixa(r, t, caixa)) return;
+    if(caixa[0] > x0) x0 = caixa[0];
+    if(caixa[1] > y0) y0 = caixa[1];
+    if(caixa[2] < x1) x1 = caixa[2];
+    if(caixa[3] < y1) y1 = caixa[3];
+    if(x0 > x1 || y0 > y1) return;
+
+    for(v = 0; v < 3; v++) p[v] = &r->xy[2*tri[v]];
+    area = (long long)(p[1][0] - p[0][0]) * (p[2][1] - p[0][1]) -
+           (long long)(p[1][1] - p[0][1]) * (p[2][0] - p[0][0]);
+    if(area == 0) return;
+
+    /* sem descarte de faces: o sentido horario vira anti-horario */
+    ordem[0] = 0;
+    ordem[1] = area < 0 ? 2 : 1;
+    ordem[2] = area < 0 ? 1 : 2;
+    if(area < 0) area = -area;
+
+    for(v = 0; v < 3; v++) p[v] = &r->xy[2*tri[ordem[v]]];
+
+    /* aresta a -> b: e = (xb - xa)(y - ya) - (yb - ya)(x - xa) >= 0 dentro.
+       Nas arestas da esquerda (descendo) e do topo (horizontal, para a
+       esquerda) o pixel sobre a aresta e do triangulo; nas outras, nao. */
+    px = (x0 << RASTER_SUB) + (1 << (RASTER_SUB - 1));
+    py = (y0 << RASTER_SUB) + (1 << (RASTER_SUB - 1));
+    for(v = 0; v < 3; v++)
+    {
+        const int *pa = p[(v + 1) % 3], *pb = p[(v + 2) % 3];   /* aresta oposta a v */
+        passoX[v] = -(long long)(pb[1] - pa[1]) * (1 << RASTER_SUB);
+        passoY[v] = (long long)(pb[0] - pa[0]) * (1 << RASTER_SUB);
+        vies[v] = (pb[1] < pa[1] || (pb[1] == pa[1] && pb[0] < pa[0])) ? 0 : -1;
+        eLinha[v] = (long long)(pb[0] - pa[0]) * (py - pa[1]) -
+                    (long long)(pb[1] - pa[1]) * (px - pa[0]) + vies[v];
+    }
+
+    for(iy = y0; iy <= y1; iy++)
+    {
+        for(v = 0; v < 3; v++) e[v] = eLinha[v];
+        d = prof + (iy % RASTER_BLOCO) * RASTER_BLOCO;
+        pix = r->imagem + ((size_t)(r->alt - 1 - iy) * r->larg) * 3;
+
+        for(ix = x0; ix <= x1; ix++)
+        {
+            if((e[0] | e[1] | e[2]) >= 0)
+            {
+                /* planos da profundidade e da cor, em pixels a partir do
+                   centro de (x0, y0): so no primeiro pixel coberto, porque
+                   a maioria dos triangulos pequenos nao cobre nenhum */
+                if(!planos)
+                {
+                    for(v = 0; v < 3; v++)
+                    {
+                        atr[v][0] = r->z[tri[ordem[v]]];
+                        for(b = 0; b < 3; b++)
+                        {
+                            atr[v][b + 1] = r->luz[tri[ordem[v]]] * cor[b];
+                            if(atr[v][b + 1] > 1.0f) atr[v][b + 1] = 1.0f;
+                        }
+                    }
+                    dx1 = (p[1][0] - p[0][0]) / (float)(1 << RASTER_SUB);
+                    dy1 = (p[1][1] - p[0][1]) / (float)(1 << RASTER_SUB);
+                    dx2 = (p[2][0] - p[0][0]) / (float)(1 << RASTER_SUB);
+                    dy2 = (p[2][1] - p[0][1]) / (float)(1 << RASTER_SUB);
+                    inv = (float)(1 << (2 * RASTER_SUB)) / (float) area;
+                    for(b = 0; b < 4; b++)
+                    {
+                        ddx[b] = ((atr[1][b] - atr[0][b]) * dy2 - (atr[2][b] - atr[0][b]) * dy1) * inv;
+                        ddy[b] = ((atr[2][b] - atr[0][b]) * dx1 - (atr[1][b] - atr[0][b]) * dx2) * inv;
+                        base[b] = atr[0][b] + ddx[b] * (px - p[0][0]) / (float)(1 << RASTER_SUB) +
+                                  ddy[b] * (py - p[0][1]) / (float)(1 << RASTER_SUB);
+                    }
+                    planos = 1;
+                }
+
+                z = base[0] + ddx[0] * (ix - x0) + ddy[0] * (iy - y0);
+                if(z >= -1.0f && z <= 1.0f && z < d[ix % RASTER_BLOCO])
+                {
+                    d[ix % RASTER_BLOCO] = z;
+                    for(b = 1; b < 4; b++)
+                        pix[3*ix + b - 1] = (unsigned char)((base[b] + ddx[b] * (ix - x0) + ddy[b] * (iy - y0)) * 255.0f + 0.5f);
+                }
+            }
+            for(v = 0; v < 3; v++) e[v] += passoX[v];
+        }
+
+        for(v = 0; v < 3; v++) eLinha[v] += passoY[v];
+    }
+}
+
+/* limpa o bloco k (fundo branco, profundidade 1, como um glClear) e
+   desenha os triangulos dele em ordem */
+static inline void rasterBloco(int k, void *arg)
+{
+    rasterImagem *r = (rasterImagem*) arg;
+    float prof[RASTER_BLOCO * RASTER_BLOCO];
+    int x0, y0, x1, y1, i;
+    size_t q;
+
+    x0 = (k % r->blocosX) * RASTER_BLOCO;
+    y0 = (k / r->blocosX) * RASTER_BLOCO;
+    x1 = x0 + RASTER_BLOCO < r->larg ? x0 + RASTER_BLOCO - 1 : r->larg - 1;
+    y1 = y0 + RASTER_BLOCO < r->alt ? y0 + RASTER_BLOCO - 1 : r->alt - 1;
+
+    for(i = 0; i < RASTER_BLOCO * RASTER_BLOCO; i++) prof[i] = 1.0f;
+    for(i = y0; i <= y1; i++)
+        memset(r->imagem + ((size_t)(r->alt - 1 - i) * r->larg + x0) * 3, 255, (size_t)(x1 - x0 + 1) * 3);
+
+    for(q = r->inicio[k]; q < r->inicio[k + 1]; q++)
+        rasterTriangulo(r, r->lista[q], x0, y0, x1, y1, prof);
+}
+
+/* primeira passada: conta por grupo e bloco; a soma, bloco a bloco e
+   grupo a grupo dentro do bloco, da a posicao de cada grupo na lista do
+   bloco. Devolve quantos indices a lista precisa. */
+static inline size_t rasterConta(rasterImagem *r)
+{
+    size_t total = 0, n;
+    int b, g;
+
+    memset(r->contagem, 0, (size_t) RASTER_GRUPOS * r->nBlocos * sizeof(size_t));
+    rasterTarefas(r, RASTER_GRUPOS, rasterContaGrupo);
+    for(b = 0; b < r->nBlocos; b++)
+    {
+        r->inicio[b] = total;
+        for(g = 0; g < RASTER_GRUPOS; g++)
+        {
+            n = r->contagem[(size_t) g * r->nBlocos + b];
+            r->contagem[(size_t) g * r->nBlocos + b] = total;
+            total += n;
+        }
+    }
+    r->inicio[r->nBlocos] = total;
+    return total;
+}
+
+/* segunda passada e desenho de todos os blocos em r->imagem */
+static inline void rasterDesenha(rasterImagem *r)
+{
+    rasterTarefas(r, RASTER_GRUPOS, rasterEscreveGrupo);
+    rasterTarefas(r, r->nBlocos, rasterBloco);
+}
+
+/* PNG sem zlib: um bloco deflate com os codigos fixos, repetindo o pixel
+   anterior ou o de cima (distancias 3 e uma linha), o que basta para o
+   fundo liso e as faixas de cor das superficies. Linhas mais longas que a
+   janela do deflate (32 KB, mais de 10922 pixels) so repetem o anterior. */
+static const unsigned short pngBaseComp[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                               35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char pngExtraComp[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short pngBaseDist[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                               257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                               8193, 12289, 16385, 24577};
+
+typedef struct st_pngBits
+{
+    unsigned char *p;
+    size_t n;
+    uint64_t acum;
+    int nBits;
+} pngBits;
+
+static inline void pngPoeBits(pngBits *s, unsigned v, int n)
+{
+    s->acum |= (uint64_t) v << s->nBits;
+    s->nBits += n;
+    while(s->nBits >= 8)
+    {
+        s->p[s->n++] = (unsigned char) s->acum;
+        s->acum >>= 8;
+        s->nBits -= 8;
+    }
+}
+
+/* codigo de Huffman (n bits, o primeiro bit e o mais significativo) */
+static inline void pngPoeCodigo(pngBits *s, unsigned c, int n)
+{
+    unsigned inv = 0;
+    int k;
+
+    for(k = 0; k < n; k++) inv |= ((c >> k) & 1) << (n - 1 - k);
+    pngPoeBits(s, inv, n);
+}
+
+static inline void pngPoeLiteral(pngBits *s, int v)
+{
+    if(v < 144) pngPoeCodigo(s, 0x30 + v, 8);
+    else if(v < 256) pngPoeCodigo(s, 0x190 + v - 144, 9);
+    else if(v < 280) pngPoeCodigo(s, v - 256, 7);
+    else pngPoeCodigo(s, 0xC0 + v - 280, 8);
+}
+
+static inline void pngPoeRepeticao(pngBits *s, int comp, int dist)
+{
+    int c, d;
+
+    for(c = 28; pngBaseComp[c] > comp; c--);
+    pngPoeLiteral(s, 257 + c);
+    pngPoeBits(s, comp - pngBaseComp[c], pngExtraComp[c]);
+    for(d = 29; pngBaseDist[d] > dist; d--);
+    pngPoeCodigo(s, d, 5);
+    pngPoeBits(s, dist - pngBaseDist[d], d < 4 ? 0 : d / 2 - 1);
+}
+
+static inline uint32_t pngCrc(uint32_t crc, const unsigned char *p, size_t n)
+{
+    static uint32_t tab[256];
+    uint32_t c;
+    int k, b;
+
+    if(!tab[1])
+        for(k = 0; k < 256; k++)
+        {
+            c = k;
+            for(b = 0; b < 8; b++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            tab[k] = c;
+        }
+
+    crc = ~crc;
+    while(n--) crc = tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline void pngGrava32(FILE *f, uint32_t v)
+{
+    unsigned char b[4] = {(unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char) v};
+    fwrite(b, 1, 4, f);
+}
+
+static inline void pngGravaPedaco(FILE *f, const char *tipo, const unsigned char *dados, size_t n)
+{
+    pngGrava32(f, (uint32_t) n);
+    fwrite(tipo, 1, 4, f);
+    fwrite(dados, 1, n, f);
+    pngGrava32(f, pngCrc(pngCrc(0, (const unsigned char*) tipo, 4), dados, n));
+}
+
+static inline int imagemGravaPNG(FILE *f, const unsigned char *rgb, int larg, int alt)
+{
+    static const unsigned char assinatura[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+    unsigned char cab[13];
+    size_t linha = (size_t) larg * 3 + 1, total = linha * alt, i;
+    unsigned char *cru;
+    pngBits s;
+    uint32_t a1 = 1, a2 = 0;
+    int comp, c3, cL, y, cima = linha <= 32768;
+
+    /* linhas com o filtro 0 na frente */
+    cru = (unsigned char*) malloc(total);
+    s.p = (unsigned char*) malloc(total + total / 8 + 64);
+    if(!cru || !s.p)
+    {
+        free(cru);
+        free(s.p);
+        return 0;
+    }
+    for(y = 0; y < alt; y++)
+    {
+        cru[y * linha] = 0;
+        memcpy(cru + y * linha + 1, rgb + (size_t) y * larg * 3, linha - 1);
+    }
+
+    s.n = 0;
+    s.acum = 0;
+    s.nBits = 0;
+    s.p[s.n++] = 0x78;   /* zlib: deflate, janela de 32 KB */
+    s.p[s.n++] = 0x01;
+    pngPoeBits(&s, 1, 1);   /* ultimo bloco */
+    pngPoeBits(&s, 1, 2);   /* codigos fixos */
+
+    for(i = 0; i < total; i += comp)
+    {
+        c3 = cL = 0;
+        if(i >= 3)
+            while(c3 < 258 && i + c3 < total && cru[i + c3] == cru[i + c3 - 3]) c3++;
+        if(cima && i >= linha)
+            while(cL < 258 && i + cL < total && cru[i + cL] == cru[i + cL - linha]) cL++;
+
+        if(c3 >= 3 && c3 >= cL)       pngPoeRepeticao(&s, comp = c3, 3);
+        else if(cL >= 3)              pngPoeRepeticao(&s, comp = cL, (int) linha);
+        else                          { pngPoeLiteral(&s, cru[i]); comp = 1; }
+    }
+    pngPoeLiteral(&s, 256);
+    if(s.nBits) pngPoeBits(&s, 0, 8 - s.nBits);
+
+    for(i = 0; i < total; i++)
+    {
+        a1 = (a1 + cru[i]) % 65521;
+        a2 = (a2 + a1) % 65521;
+    }
+    s.p[s.n++] = (unsigned char)(a2 >> 8);
+    s.p[s.n++] = (unsigned char) a2;
+    s.p[s.n++] = (unsigned char)(a1 >> 8);
+    s.p[s.n++] = (unsigned char) a1;
+
+    fwrite(assinatura, 1, 8, f);
+    cab[0] = (unsigned char)(larg >> 24); cab[1] = (unsigned char)(larg >> 16);
+    cab[2] = (unsigned char)(larg >> 8);  cab[3] = (unsigned char) larg;
+    cab[4] = (unsigned char)(alt >> 24);  cab[5] = (unsigned char)(alt >> 16);
+    cab[6] = (unsigned char)(alt >> 8);   cab[7] = (unsigned char) alt;
+    cab[8] = 8;    /* bits por canal */
+    cab[9] = 2;    /* RGB */
+    cab[10] = cab[11] = cab[12] = 0;
+    pngGravaPedaco(f, "IHDR", cab, 13);
+    pngGravaPedaco(f, "IDAT", s.p, s.n);
+    pngGravaPedaco(f, "IEND", NULL, 0);
+
+    free(cru);
+    free(s.p);
+    return 1;
+}
+
+/* grava a imagem RGB (linha 0 em cima) como PNG ou, se arq terminar em
+   .ppm, como PPM binario */
+static inline int imagemGrava(const char *arq, const unsigned char *rgb, int larg, int alt)
+{
+    FILE *f;
+    const char *ext = strrchr(arq, '.');
+    int ok;
+
+    if((f = fopen(arq, "wb")) == NULL)
+    {
+        printf("Erro ao criar o arquivo %s \n", arq);
+        return 0;
+    }
+
+    if(ext && strcmp(ext, ".ppm") == 0)
+    {
+        fprintf(f, "P6\n%d %d\n255\n", larg, alt);
+        ok = fwrite(rgb, 1, (size_t) larg * alt * 3, f) == (size_t) larg * alt * 3;
+    }
+    else
+        ok = imagemGravaPNG(f, rgb, larg, alt);
+
+    if(ferror(f)) ok = 0;
+    if(fclose(f) != 0) ok = 0;
+    if(!ok) printf("Erro ao gravar %s\n", arq);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,309 @@
+/* spline.h
+   Bases cubicas (Hermite, Bezier, B-spline e Catmull-Rom) compartilhadas
+   pelas curvas (Trab1) e pelas superficies (Trab2). So cabecalho, em C
+   e em C++.
+
+   Um segmento e p(t) = [t^3 t^2 t 1] M G, com G os 4 pontos de controle
+   (Hermite: P0, P1, T0, T1). As matrizes sao constantes de compilacao e
+   as funcoes sao inline: chamadas com a base constante (um literal, ou o
+   parametro dos templates em C++) sao geradas uma vez para cada base,
+   com os coeficientes dobrados, os lacos desenrolados e os termos nulos
+   de M omitidos. As versoes ...Matriz recebem M em tempo de execucao e
+   fazem todas as contas.
+*/
+
+#ifndef SPLINE_H
+#define SPLINE_H
+
+#define SPLINE_HERMITE    0
+#define SPLINE_BEZIER     1
+#define SPLINE_BSPLINE    2
+#define SPLINE_CATMULLROM 3
+#define SPLINE_NUM_BASES  4
+
+#ifdef __cplusplus
+#define SPLINE_CONST constexpr
+#else
+#define SPLINE_CONST const
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8
+#define SPLINE_DESENROLA _Pragma("GCC unroll 4")
+#elif defined(__clang__)
+#define SPLINE_DESENROLA _Pragma("unroll 4")
+#else
+#define SPLINE_DESENROLA
+#endif
+
+/* as funcoes com a base como parametro so sao especializadas se forem
+   expandidas no chamador, mesmo quando o compilador as acha grandes */
+#if defined(__GNUC__) || defined(__clang__)
+#define SPLINE_INLINE static inline __attribute__((always_inline))
+#else
+#define SPLINE_INLINE static inline
+#endif
+
+/* splineMatriz[base][a][b]: linha a multiplica t^(3-a). Os valores sao os
+   mesmos (em float) das matrizes que cada programa montava a mao. */
+static SPLINE_CONST float splineMatriz[SPLINE_NUM_BASES][4][4] = {
+    /* Hermite */
+    {{ 2.0f, -2.0f,  1.0f,  1.0f},
+     {-3.0f,  3.0f, -2.0f, -1.0f},
+     { 0.0f,  0.0f,  1.0f,  0.0f},
+     { 1.0f,  0.0f,  0.0f,  0.0f}},
+    /* Bezier */
+    {{-1.0f,  3.0f, -3.0f,  1.0f},
+     { 3.0f, -6.0f,  3.0f,  0.0f},
+     {-3.0f,  3.0f,  0.0f,  0.0f},
+     { 1.0f,  0.0f,  0.0f,  0.0f}},
+    /* B-spline */
+    {{(float)(-1.0/6.0), (float)( 3.0/6.0), (float)(-3.0/6.0), (float)(1.0/6.0)},
+     {(float)( 3.0/6.0), (float)(-6.0/6.0), (float)( 3.0/6.0), 0.0f},
+     {(float)(-3.0/6.0), 0.0f,              (float)( 3.0/6.0), 0.0f},
+     {(float)( 1.0/6.0), (float)( 4.0/6.0), (float)( 1.0/6.0), 0.0f}},
+    /* Catmull-Rom */
+    {{-0.5f,  1.5f, -1.5f,  0.5f},
+     { 1.0f, -2.5f,  2.0f, -0.5f},
+     {-0.5f,  0.0f,  0.5f,  0.0f},
+     { 0.0f,  1.0f,  0.0f,  0.0f}}
+};
+
+/* splineParaBezier[base]: pontos de Bezier do mesmo segmento, B = K G
+   (K = inversa da matriz de Bezier vezes a da base) */
+static SPLINE_CONST float splineParaBezier[SPLINE_NUM_BASES][4][4] = {
+    /* Hermite: P0, P0 + T0/3, P1 - T1/3, P1 */
+    {{1.0f, 0.0f, 0.0f,              0.0f},
+     {1.0f, 0.0f, (float)(1.0/3.0),  0.0f},
+     {0.0f, 1.0f, 0.0f,              (float)(-1.0/3.0)},
+     {0.0f, 1.0f, 0.0f,              0.0f}},
+    /* Bezier */
+    {{1.0f, 0.0f, 0.0f, 0.0f},
+     {0.0f, 1.0f, 0.0f, 0.0f},
+     {0.0f, 0.0f, 1.0f, 0.0f},
+     {0.0f, 0.0f, 0.0f, 1.0f}},
+    /* B-spline: (P0 + 4P1 + P2)/6, (4P1 + 2P2)/6, (2P1 + 4P2)/6, (P1 + 4P2 + P3)/6 */
+    {{(float)(1.0/6.0), (float)(4.0/6.0), (float)(1.0/6.0), 0.0f},
+     {0.0f,             (float)(4.0/6.0), (float)(2.0/6.0), 0.0f},
+     {0.0f,             (float)(2.0/6.0), (float)(4.0/6.0), 0.0f},
+     {0.0f,             (float)(1.0/6.0), (float)(4.0/6.0), (float)(1.0/6.0)}},
+    /* Catmull-Rom: P1, P1 + (P2 - P0)/6, P2 - (P3 - P1)/6, P2 */
+    {{0.0f,              1.0f,             0.0f,             0.0f},
+     {(float)(-1.0/6.0), 1.0f,             (float)(1.0/6.0), 0.0f},
+     {0.0f,              (float)(1.0/6.0), 1.0f,             (float)(-1.0/6.0)},
+     {0.0f,              0.0f,             1.0f,             0.0f}}
+};
+
+/* pesos dos 4 pontos em t: w[b] = sum_a t^(3-a) M[a][b] */
+SPLINE_INLINE void splinePesos(int base, float t, float w[4])
+{
+    float tt[4];
+    int a, b;
+
+    tt[0] = t*t*t; tt[1] = t*t; tt[2] = t; tt[3] = 1.0f;
+
+    SPLINE_DESENROLA
+    for(b = 0; b < 4; b++)
+    {
+        w[b] = 0.0f;
+        SPLINE_DESENROLA
+        for(a = 0; a < 4; a++)
+            if(splineMatriz[base][a][b] != 0.0f) w[b] += tt[a] * splineMatriz[base][a][b];
+    }
+}
+
+static inline void splinePesosMatriz(const float m[4][4], float t, float w[4])
+{
+    float tt[4];
+    int a, b;
+
+    tt[0] = t*t*t; tt[1] = t*t; tt[2] = t; tt[3] = 1.0f;
+
+    for(b = 0; b < 4; b++)
+    {
+        w[b] = 0.0f;
+        for(a = 0; a < 4; a++)
+            w[b] += tt[a] * m[a][b];
+    }
+}
+
+/* ponto do segmento em t; g sao os 4 pontos de controle (x, y, z) */
+SPLINE_INLINE void splinePonto(int base, float t, const float g[4][3], float p[3])
+{
+    float w[4];
+    int b;
+
+    splinePesos(base, t, w);
+    p[0] = p[1] = p[2] = 0.0f;
+    SPLINE_DESENROLA
+    for(b = 0; b < 4; b++)
+    {
+        p[0] += w[b] * g[b][0];
+        p[1] += w[b] * g[b][1];
+        p[2] += w[b] * g[b][2];
+    }
+}
+
+static inline void splinePontoMatriz(const float m[4][4], float t, const float g[4][3], float p[3])
+{
+    float w[4];
+    int b;
+
+    splinePesosMatriz(m, t, w);
+    p[0] = p[1] = p[2] = 0.0f;
+    for(b = 0; b < 4; b++)
+    {
+        p[0] += w[b] * g[b][0];
+        p[1] += w[b] * g[b][1];
+        p[2] += w[b] * g[b][2];
+    }
+}
+
+/* coeficientes do patch bicubico C = M P M^t (x, y, z; o quarto float
+   de cada ponto nao e usado), com p(s,t) = sum s^(3-a) t^(3-b) C[a][b].
+   linha[k] aponta para os 4 pontos da linha k de P. */
+SPLINE_INLINE void splineCoeficientesPatch(int base, float (*const *linha)[4], float c[4][4][4])
+{
+    float mp[4][4][4];
+    int a, b, k, h;
+
+    SPLINE_DESENROLA
+    for(a = 0; a < 4; a++)
+        SPLINE_DESENROLA
+        for(b = 0; b < 4; b++)
+            SPLINE_DESENROLA
+            for(h = 0; h < 3; h++)
+            {
+                mp[a][b][h] = 0.0f;
+                SPLINE_DESENROLA
+                for(k = 0; k < 4; k++)
+                    if(splineMatriz[base][a][k] != 0.0f) mp[a][b][h] += splineMatriz[base][a][k] * linha[k][b][h];
+            }
+
+    SPLINE_DESENROLA
+    for(a = 0; a < 4; a++)
+        SPLINE_DESENROLA
+        for(b = 0; b < 4; b++)
+            SPLINE_DESENROLA
+            for(h = 0; h < 3; h++)
+            {
+                c[a][b][h] = 0.0f;
+                SPLINE_DESENROLA
+                for(k = 0; k < 4; k++)
+                    if(splineMatriz[base][b][k] != 0.0f) c[a][b][h] += mp[a][k][h] * splineMatriz[base][b][k];
+            }
+}
+
+static inline void splineCoeficientesPatchMatriz(const float m[4][4], float (*const *linha)[4], float c[4][4][4])
+{
+    float mp[4][4][4];
+    int a, b, k, h;
+
+    for(a = 0; a < 4; a++)
+        for(b = 0; b < 4; b++)
+            for(h = 0; h < 3; h++)
+            {
+                mp[a][b][h] = 0.0f;
+                for(k = 0; k < 4; k++) mp[a][b][h] += m[a][k] * linha[k][b][h];
+            }
+
+    for(a = 0; a < 4; a++)
+        for(b = 0; b < 4; b++)
+            for(h = 0; h < 3; h++)
+            {
+                c[a][b][h] = 0.0f;
+                for(k = 0; k < 4; k++) c[a][b][h] += mp[a][k][h] * m[b][k];
+            }
+}
+
+/* patch bicubico na forma de Bezier: Q = K P K^t (x, y, z), com K de
+   splineParaBezier. Os pontos de Bezier contem o patch no seu fecho
+   convexo, em qualquer base. */
+SPLINE_INLINE void splineParaBezierPatch(int base, float (*const *linha)[4], float q[4][4][4])
+{
+    float kp[4][4][4];
+    int a, b, k, h;
+
+    SPLINE_DESENROLA
+    for(a = 0; a < 4; a++)
+        SPLINE_DESENROLA
+        for(b = 0; b < 4; b++)
+            SPLINE_DESENROLA
+            for(h = 0; h < 3; h++)
+            {
+                kp[a][b][h] = 0.0f;
+                SPLINE_DESENROLA
+                for(k = 0; k < 4; k++)
+                    if(splineParaBezier[base][a][k] != 0.0f) kp[a][b][h] += splineParaBezier[base][a][k] * linha[k][b][h];
+            }
+
+    SPLINE_DESENROLA
+    for(a = 0; a < 4; a++)
+        SPLINE_DESENROLA
+        for(b = 0; b < 4; b++)
+        {
+            SPLINE_DESENROLA
+            for(h = 0; h < 3; h++)
+            {
+                q[a][b][h] = 0.0f;
+                SPLINE_DESENROLA
+                for(k = 0; k < 4; k++)
+                    if(splineParaBezier[base][b][k] != 0.0f) q[a][b][h] += kp[a][k][h] * splineParaBezier[base][b][k];
+            }
+            q[a][b][3] = 0.0f;
+        }
+}
+
+/* coeficientes em potencias de t da combinacao v de 4 pontos (coordenada
+   h, pontos com passo de 4 floats): cf[a] = sum_b M[a][b] v[b][h] */
+SPLINE_INLINE void splinePotencias(int base, const float v[4][4], int h, float cf[4])
+{
+    int a, b;
+
+    SPLINE_DESENROLA
+    for(a = 0; a < 4; a++)
+    {
+        cf[a] = 0.0f;
+        SPLINE_DESENROLA
+        for(b = 0; b < 4; b++)
+            if(splineMatriz[base][a][b] != 0.0f) cf[a] += splineMatriz[base][a][b] * v[b][h];
+    }
+}
+
+#ifdef __cplusplus
+/* em C++ cada base e um parametro de template: spline::ponto<SPLINE_BEZIER>
+   e uma funcao so da base de Bezier, gerada em tempo de compilacao */
+namespace spline
+{
+    template<int B> inline void pesos(float t, float w[4])
+    {
+        static_assert(B >= 0 && B < SPLINE_NUM_BASES, "base invalida");
+        splinePesos(B, t, w);
+    }
+
+    template<int B> inline void ponto(float t, const float g[4][3], float p[3])
+    {
+        static_assert(B >= 0 && B < SPLINE_NUM_BASES, "base invalida");
+        splinePonto(B, t, g, p);
+    }
+
+    template<int B> inline void coeficientesPatch(float (*const *linha)[4], float c[4][4][4])
+    {
+        static_assert(B >= 0 && B < SPLINE_NUM_BASES, "base invalida");
+        splineCoeficientesPatch(B, linha, c);
+    }
+
+    template<int B> inline void paraBezierPatch(float (*const *linha)[4], float q[4][4][4])
+    {
+        static_assert(B >= 0 && B < SPLINE_NUM_BASES, "base invalida");
+        splineParaBezierPatch(B, linha, q);
+    }
+
+    template<int B> inline void potencias(const float v[4][4], int h, float cf[4])
+    {
+        static_assert(B >= 0 && B < SPLINE_NUM_BASES, "base invalida");
+        splinePotencias(B, v, h, cf);
+    }
+}
+#endif
+
+#endif